@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cipher.h"
+#include "engine.h"
+#include "pack.h"
+#include "packed.h"
+#include "perf.h"
+
+/* State shared by the benchmark cases. Each case runs iLen operations of one kind. */
+struct benchState_tag
+{
+  deck_t*  pDeck;
+  packed_t packed;
+  int*     pKey;   // iLen key values, 1-26
+  char*    pText;  // iLen cleaned letters
+  unsigned iCheck; // Keeps results live so nothing is optimized away
+};
+typedef struct benchState_tag benchState_t;
+
+struct benchCase_tag
+{
+  const char* pName;
+  const char* pUnit;
+  void (*run)(benchState_t* pState, size_t iLen);
+};
+typedef struct benchCase_tag benchCase_t;
+
+void runMoveJokers(benchState_t* pState, size_t iLen);
+void runTripleCut(benchState_t* pState, size_t iLen);
+void runCountCutBottom(benchState_t* pState, size_t iLen);
+void runCountCutValue(benchState_t* pState, size_t iLen);
+void runGenKeystream(benchState_t* pState, size_t iLen);
+void runKeyScheduleRef(benchState_t* pState, size_t iLen);
+void runPackedStep(benchState_t* pState, size_t iLen);
+void runPackedKeystream(benchState_t* pState, size_t iLen);
+void runMakeDeckFromKey(benchState_t* pState, size_t iLen);
+void runCipher(benchState_t* pState, size_t iLen);
+void printResult(const benchCase_t* pCase, perf_t* pPerf, size_t iLen);
+
+static const benchCase_t CASES[] =
+{
+  { "moveJokers",          "op",     runMoveJokers },
+  { "tripleCut",           "op",     runTripleCut },
+  { "countCutBottom",      "op",     runCountCutBottom },
+  { "countCutValue",       "op",     runCountCutValue },
+  { "genKeystream",        "letter", runGenKeystream },
+  { "key schedule (ref)",  "char",   runKeyScheduleRef },
+  { "packedStep",          "op",     runPackedStep },
+  { "packedKeystream",     "letter", runPackedKeystream },
+  { "makeDeckFromKey",     "char",   runMakeDeckFromKey },
+  { "cipher",              "letter", runCipher }
+};
+
+/* Time each deck primitive, the keystream and key schedule, end-to-end cipher(), each keystream engine and each
+   5-bit packer. Hardware counters are read with perf_event_open where available; every figure is per operation.
+   Usage: solitaire-bench [operations] */
+int main(int argc, char **argv)
+{
+  size_t iLen = 1000000;
+  if (argc > 1)
+    iLen = strtoul(argv[1], NULL, 10);
+
+  if (iLen == 0)
+  {
+    fprintf(stderr, "Operation count must be positive.\n");
+    return EXIT_FAILURE;
+  }
+
+  benchState_t state;
+  state.pKey = malloc(iLen * sizeof(int));
+  state.pText = malloc(iLen * sizeof(char));
+  for (size_t i = 0; i < iLen; i++)
+  {
+    state.pKey[i] = (int)(i * 7 % 26) + 1;
+    state.pText[i] = (char)('A' + i * 11 % 26);
+  }
+  state.iCheck = 0;
+
+  perf_t perf;
+  perfOpen(&perf);
+  if (!perfAvailable(&perf, PERF_CYCLES))
+    fprintf(stderr, "Hardware counters are unavailable; reporting wall-clock time only.\n");
+
+  printf("%-20s %10s %10s", "benchmark", "unit", "ns");
+  for (counter_t c = 0; c < NUM_COUNTERS; c++)
+    printf(" %10s", perfName(c));
+  printf("\n");
+
+  for (size_t i = 0; i < sizeof(CASES) / sizeof(CASES[0]); i++)
+  {
+    // Every case starts from the same standard deck
+    state.pDeck = makeStandardDeck();
+    packDeck(state.pDeck, &state.packed);
+    perfStart(&perf);
+    CASES[i].run(&state, iLen);
+    perfStop(&perf);
+    printResult(&CASES[i], &perf, iLen);
+    freeDeck(state.pDeck);
+  }
+
+  // Each keystream engine this CPU supports, from the same standard deck
+  size_t nEngines = 0;
+  const engine_t* pEngines = engineList(&nEngines);
+  unsigned char* pValues = malloc(iLen);
+  for (size_t i = 0; i < nEngines; i++)
+  {
+    if (!pEngines[i].supported())
+      continue;
+    char name[32];
+    snprintf(name, sizeof(name), "engine %s", pEngines[i].pName);
+    benchCase_t engineCase = { name, "letter", NULL };
+    standardPacked(&state.packed);
+    perfStart(&perf);
+    pEngines[i].keystream(&state.packed, pValues, iLen);
+    perfStop(&perf);
+    printResult(&engineCase, &perf, iLen);
+    state.iCheck += pValues[iLen - 1];
+  }
+
+  // Each 5-bit packer this CPU supports, packing and then unpacking the last engine's keystream values
+  size_t nPackers = 0;
+  const packer_t* pPackers = packerList(&nPackers);
+  unsigned char* pPacked = malloc(PACKED_SIZE(iLen));
+  memset(pPacked, 0, PACKED_SIZE(iLen)); // Fault the pages in before timing
+  for (size_t i = 0; i < nPackers; i++)
+  {
+    if (!pPackers[i].supported())
+      continue;
+    char name[32];
+    snprintf(name, sizeof(name), "pack5 %s", pPackers[i].pName);
+    benchCase_t packCase = { name, "letter", NULL };
+    perfStart(&perf);
+    pPackers[i].pack(pValues, iLen, pPacked);
+    perfStop(&perf);
+    printResult(&packCase, &perf, iLen);
+
+    snprintf(name, sizeof(name), "unpack5 %s", pPackers[i].pName);
+    perfStart(&perf);
+    pPackers[i].unpack(pPacked, 0, iLen, pValues);
+    perfStop(&perf);
+    printResult(&packCase, &perf, iLen);
+    state.iCheck += pValues[iLen - 1];
+  }
+  free(pPacked);
+  free(pValues);
+
+  perfClose(&perf);
+  free(state.pKey);
+  free(state.pText);
+  return state.iCheck == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* Print one row of per-operation figures. Counters that are unavailable, or never got onto the PMU, are shown as '-'. */
+void printResult(const benchCase_t* pCase, perf_t* pPerf, size_t iLen)
+{
+  printf("%-20s %10s %10.1f", pCase->pName, pCase->pUnit, pPerf->dSeconds * 1e9 / iLen);
+  for (counter_t c = 0; c < NUM_COUNTERS; c++)
+  {
+    if (perfCounted(pPerf, c))
+      printf(" %10.2f", (double)pPerf->values[c] / iLen);
+    else
+      printf(" %10s", "-");
+  }
+  printf("\n");
+}
+
+void runMoveJokers(benchState_t* pState, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+    moveJokers(pState->pDeck);
+  pState->iCheck += pState->pDeck->cards[0]->value;
+}
+
+void runTripleCut(benchState_t* pState, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+  {
+    moveJokers(pState->pDeck); // Keep the Jokers moving so the cut is not the same every time
+    tripleCut(pState->pDeck);
+  }
+  pState->iCheck += pState->pDeck->cards[0]->value;
+}
+
+void runCountCutBottom(benchState_t* pState, size_t iLen)
+{
+  moveCard(pState->pDeck, 0, DECK_SIZE - 1); // Put a non-Joker on the bottom, or the cut does nothing
+  for (size_t i = 0; i < iLen; i++)
+    countCutBottom(pState->pDeck);
+  pState->iCheck += pState->pDeck->cards[0]->value;
+}
+
+void runCountCutValue(benchState_t* pState, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+    countCutValue(pState->pDeck, pState->pKey[i]);
+  pState->iCheck += pState->pDeck->cards[0]->value;
+}
+
+void runGenKeystream(benchState_t* pState, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+    pState->iCheck += genKeystream(pState->pDeck);
+}
+
+void runKeyScheduleRef(benchState_t* pState, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+  {
+    moveJokers(pState->pDeck);
+    tripleCut(pState->pDeck);
+    countCutBottom(pState->pDeck);
+    countCutValue(pState->pDeck, pState->pKey[i]);
+  }
+  pState->iCheck += pState->pDeck->cards[0]->value;
+}
+
+void runPackedStep(benchState_t* pState, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+    packedStep(&pState->packed);
+  pState->iCheck += pState->packed.cards[0];
+}
+
+void runPackedKeystream(benchState_t* pState, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+    pState->iCheck += packedKeystream(&pState->packed);
+}
+
+void runMakeDeckFromKey(benchState_t* pState, size_t iLen)
+{
+  deck_t* pDeck = makeDeckFromKey(pState->pKey, iLen);
+  pState->iCheck += pDeck->cards[0]->value;
+  freeDeck(pDeck);
+}
+
+void runCipher(benchState_t* pState, size_t iLen)
+{
+  char* pOut = cipher(true, pState->pDeck, pState->pText, iLen);
+  pState->iCheck += pOut[0];
+  free(pOut);
+}
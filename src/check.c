@@ -0,0 +1,1015 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cipher.h"
+#include "container.h"
+#include "dir.h"
+#include "engine.h"
+#include "file.h"
+#include "filter.h"
+#include "mini.h"
+#include "pack.h"
+#include "packed.h"
+#include "pad.h"
+#include "reference.h"
+#include "schedule.h"
+#include "session.h"
+
+/* An optimized keystream engine under test: fill pOut with iLen keystream values (1-26) */
+struct checkEngine_tag
+{
+  const char* pName;
+  void (*keystream)(packed_t* pPacked, unsigned char* pOut, size_t iLen);
+};
+typedef struct checkEngine_tag checkEngine_t;
+
+/* Schneier's published test vectors */
+struct vector_tag
+{
+  const char* pKey; // NULL for an unkeyed standard deck
+  const char* pPlain;
+  const char* pCipher;
+};
+typedef struct vector_tag vector_t;
+
+void singleKeystream(packed_t* pPacked, unsigned char* pOut, size_t iLen);
+void addEngines();
+uint64_t nextRandom();
+void randomDeck(deck_t* pDeck);
+bool sameDeck(deck_t* pRef, packed_t* pPacked);
+void fail(const char* pCheck, const char* pEngine, unsigned iCase, const char* pDetail);
+char* readWhole(const char* pFile, size_t* pLen);
+char* outputText(const char* pSummary);
+void randomText(char* pText, size_t iLen);
+void checkVectors();
+void checkSteps(unsigned nCases);
+void checkKeystream(unsigned nCases);
+void checkKeySchedule(unsigned nCases);
+void checkCipher(unsigned nCases);
+void checkPack(unsigned nCases);
+void checkMini(unsigned nCases);
+void checkStreamSchedule(unsigned nCases);
+void checkDirectory(unsigned nFiles);
+void checkBytes(unsigned nCases);
+void checkPad(unsigned nCases);
+void checkFilter(unsigned nRecords);
+void checkSession(unsigned nCases);
+void checkContainer(unsigned nCases);
+
+#define MAX_ENGINES 16
+
+static checkEngine_t ENGINES[MAX_ENGINES] =
+{
+  { "packed", singleKeystream }
+};
+static size_t NUM_ENGINES = 1; // Registry engines this CPU supports are added by addEngines()
+
+static const vector_t VECTORS[] =
+{
+  { NULL,            "AAAAAAAAAAAAAAA",           "EXKYIZSGEHUNTIQ" },
+  { "f",             "AAAAAAAAAAAAAAA",           "XYIUQBMHKKJBEGY" },
+  { "fo",            "AAAAAAAAAAAAAAA",           "TUJYMBERLGXNDIW" },
+  { "foo",           "AAAAAAAAAAAAAAA",           "ITHZUJIWGRFARMW" },
+  { "a",             "AAAAAAAAAAAAAAA",           "XODALGSCULIQNSC" },
+  { "aa",            "AAAAAAAAAAAAAAA",           "OHGWMXXCAIMCIQP" },
+  { "aaa",           "AAAAAAAAAAAAAAA",           "DCSQYHBQZNGDRUT" },
+  { "b",             "AAAAAAAAAAAAAAA",           "XQEEMOITLZVDSQS" },
+  { "bc",            "AAAAAAAAAAAAAAA",           "QNGRKQIHCLGWSCE" },
+  { "bcd",           "AAAAAAAAAAAAAAA",           "FMUBYBMAXHNQXCJ" },
+  { "cryptonomicon", "AAAAAAAAAAAAAAAAAAAAAAAAA", "SUGSRSXSWQRMXOHIPBFPXARYQ" },
+  { "cryptonomicon", "SOLITAIRE",                 "KIRAKSFJA" }
+};
+
+static uint64_t gState = 0x2545F4914F6CDD1DULL;
+static unsigned gChecks = 0;
+static unsigned gFailures = 0;
+
+/* Run the published vectors, then randomized differential checks of every engine against the frozen
+   reference implementation. Usage: solitaire-check [cases] [seed] */
+int main(int argc, char **argv)
+{
+  unsigned nCases = 200;
+  if (argc > 1)
+    nCases = (unsigned)strtoul(argv[1], NULL, 10);
+  if (argc > 2)
+    gState = strtoull(argv[2], NULL, 10) | 1;
+
+  addEngines();
+  checkVectors();
+  checkSteps(nCases);
+  checkKeystream(nCases);
+  checkKeySchedule(nCases);
+  checkCipher(nCases);
+  checkPack(nCases);
+  checkMini(nCases);
+  checkStreamSchedule(nCases / 40 + 1);
+  checkDirectory(300);
+  checkBytes(nCases);
+  checkPad(nCases / 40 + 1);
+  checkFilter(nCases * 10);
+  checkSession(nCases);
+  checkContainer(nCases / 40 + 1);
+
+  printf("%u checks, %u failures\n", gChecks, gFailures);
+  return gFailures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* The unbatched engine: one packedKeystream() call per value */
+void singleKeystream(packed_t* pPacked, unsigned char* pOut, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+    pOut[i] = (unsigned char)packedKeystream(pPacked);
+}
+
+/* Add every engine in the registry that this CPU can run */
+void addEngines()
+{
+  size_t nRegistered = 0;
+  const engine_t* pEngines = engineList(&nRegistered);
+  for (size_t i = 0; i < nRegistered && NUM_ENGINES < MAX_ENGINES; i++)
+  {
+    if (!pEngines[i].supported())
+    {
+      printf("Skipping engine %s: not supported by this CPU\n", pEngines[i].pName);
+      continue;
+    }
+    ENGINES[NUM_ENGINES].pName = pEngines[i].pName;
+    ENGINES[NUM_ENGINES].keystream = pEngines[i].keystream;
+    NUM_ENGINES++;
+  }
+}
+
+/* xorshift64* so every run with the same seed checks the same cases */
+uint64_t nextRandom()
+{
+  gState ^= gState >> 12;
+  gState ^= gState << 25;
+  gState ^= gState >> 27;
+  return gState * 2685821657736338717ULL;
+}
+
+/* Read the whole of pFile into an allocated, null-terminated buffer, or return NULL if it cannot be read */
+char* readWhole(const char* pFile, size_t* pLen)
+{
+  FILE* f = fopen(pFile, "rb");
+  if (f == NULL)
+    return NULL;
+  char* pText = NULL;
+  size_t iLen = 0;
+  char pChunk[4096];
+  size_t iRead = 0;
+  while ((iRead = fread(pChunk, 1, sizeof(pChunk), f)) > 0)
+  {
+    pText = realloc(pText, iLen + iRead + 1);
+    memcpy(pText + iLen, pChunk, iRead);
+    iLen += iRead;
+  }
+  fclose(f);
+  if (pText == NULL)
+    pText = calloc(1, 1);
+  pText[iLen] = '\0';
+  if (pLen != NULL)
+    *pLen = iLen;
+  return pText;
+}
+
+/* Return an allocated copy of the text between the quotes of a summary's 'Output text' line, or NULL */
+char* outputText(const char* pSummary)
+{
+  const char* pStart = pSummary != NULL ? strstr(pSummary, "Output text: '") : NULL;
+  if (pStart == NULL)
+    return NULL;
+  pStart += strlen("Output text: '");
+  const char* pEnd = strchr(pStart, '\'');
+  return pEnd != NULL ? strndup(pStart, (size_t)(pEnd - pStart)) : NULL;
+}
+
+/* Fill pText with iLen letters, with the odd space and punctuation for the cleaner to remove, and terminate it */
+void randomText(char* pText, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+  {
+    unsigned iChar = (unsigned)(nextRandom() % 60);
+    pText[i] = iChar < 26 ? (char)('A' + iChar) : iChar < 52 ? (char)('a' + iChar - 26) : " ,.!-'?;"[iChar - 52];
+  }
+  pText[0] = 'M'; // At least one letter
+  pText[iLen] = '\0';
+}
+
+/* Fisher-Yates shuffle of a full deck */
+void randomDeck(deck_t* pDeck)
+{
+  for (size_t i = pDeck->nCards - 1; i > 0; i--)
+  {
+    size_t j = nextRandom() % (i + 1);
+    card_t* pTemp = pDeck->cards[i];
+    pDeck->cards[i] = pDeck->cards[j];
+    pDeck->cards[j] = pTemp;
+  }
+}
+
+/* True if the reference deck and packed deck have the same order */
+bool sameDeck(deck_t* pRef, packed_t* pPacked)
+{
+  packed_t ref;
+  packDeck(pRef, &ref);
+  return memcmp(ref.cards, pPacked->cards, DECK_SIZE) == 0;
+}
+
+void fail(const char* pCheck, const char* pEngine, unsigned iCase, const char* pDetail)
+{
+  gFailures++;
+  fprintf(stderr, "FAIL %s [%s] case %u: %s\n", pCheck, pEngine, iCase, pDetail);
+}
+
+/* Every published vector through the reference and every engine */
+void checkVectors()
+{
+  for (unsigned v = 0; v < sizeof(VECTORS) / sizeof(VECTORS[0]); v++)
+  {
+    const vector_t* pVector = &VECTORS[v];
+    size_t iLen = strlen(pVector->pPlain);
+
+    deck_t* pRef = makeStandardDeck();
+    packed_t start;
+    standardPacked(&start);
+    if (pVector->pKey != NULL)
+    {
+      size_t iKeyLen = strlen(pVector->pKey);
+      int* pKey = malloc(iKeyLen * sizeof(int));
+      for (size_t i = 0; i < iKeyLen; i++)
+        pKey[i] = pVector->pKey[i] - 'a' + 1;
+      refKeySchedule(pRef, pKey, iKeyLen);
+      free(pKey);
+      keyToPacked(pVector->pKey, false, &start);
+    }
+
+    char* pOut = malloc(iLen + 1);
+    for (size_t i = 0; i < iLen; i++)
+      pOut[i] = combineChar(true, pVector->pPlain[i], refGenKeystream(pRef));
+    pOut[iLen] = '\0';
+    gChecks++;
+    if (strcmp(pOut, pVector->pCipher) != 0)
+      fail("vector", "reference", v, pOut);
+
+    unsigned char* pKeys = malloc(iLen);
+    for (size_t e = 0; e < NUM_ENGINES; e++)
+    {
+      packed_t packed = start;
+      ENGINES[e].keystream(&packed, pKeys, iLen);
+      for (size_t i = 0; i < iLen; i++)
+        pOut[i] = combineChar(true, pVector->pPlain[i], pKeys[i]);
+      gChecks++;
+      if (strcmp(pOut, pVector->pCipher) != 0)
+        fail("vector", ENGINES[e].pName, v, pOut);
+    }
+
+    free(pKeys);
+    free(pOut);
+    freeDeck(pRef);
+  }
+}
+
+/* Single deck steps from random decks, compared after every step. Every engine is then run one keystream
+   value at a time from the same deck, so the deck is compared after each value rather than once per block. */
+void checkSteps(unsigned nCases)
+{
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    deck_t* pRef = makeStandardDeck();
+    randomDeck(pRef);
+    deck_t* pStart = copyDeck(pRef);
+    packed_t packed;
+    packDeck(pRef, &packed);
+
+    for (unsigned s = 0; s < 200; s++)
+    {
+      refMoveJokers(pRef);
+      refTripleCut(pRef);
+      refCountCutBottom(pRef);
+      packedStep(&packed);
+      gChecks++;
+      if (!sameDeck(pRef, &packed))
+      {
+        fail("step", "packed", c, "deck order differs");
+        break;
+      }
+    }
+
+    for (size_t e = 0; e < NUM_ENGINES; e++)
+    {
+      freeDeck(pRef);
+      pRef = copyDeck(pStart);
+      packDeck(pRef, &packed);
+      for (unsigned s = 0; s < 200; s++)
+      {
+        unsigned char iValue = 0;
+        int iExpect = refGenKeystream(pRef);
+        ENGINES[e].keystream(&packed, &iValue, 1);
+        gChecks++;
+        if (iValue != iExpect || !sameDeck(pRef, &packed))
+        {
+          fail("step", ENGINES[e].pName, c, iValue != iExpect ? "value differs" : "deck order differs");
+          break;
+        }
+      }
+    }
+    freeDeck(pRef);
+    freeDeck(pStart);
+  }
+}
+
+/* Keystreams of random length from random decks; values and final decks must match */
+void checkKeystream(unsigned nCases)
+{
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    deck_t* pRef = makeStandardDeck();
+    randomDeck(pRef);
+    packed_t start;
+    packDeck(pRef, &start);
+
+    size_t iLen = 1 + nextRandom() % 2000;
+    unsigned char* pExpect = malloc(iLen);
+    unsigned char* pGot = malloc(iLen);
+    for (size_t i = 0; i < iLen; i++)
+      pExpect[i] = (unsigned char)refGenKeystream(pRef);
+
+    for (size_t e = 0; e < NUM_ENGINES; e++)
+    {
+      packed_t packed = start;
+      ENGINES[e].keystream(&packed, pGot, iLen);
+      gChecks++;
+      if (memcmp(pExpect, pGot, iLen) != 0)
+        fail("keystream", ENGINES[e].pName, c, "values differ");
+      else if (!sameDeck(pRef, &packed))
+        fail("keystream", ENGINES[e].pName, c, "final deck differs");
+    }
+
+    free(pExpect);
+    free(pGot);
+    freeDeck(pRef);
+  }
+}
+
+/* Random keys from random decks through the key schedule */
+void checkKeySchedule(unsigned nCases)
+{
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    deck_t* pRef = makeStandardDeck();
+    randomDeck(pRef);
+    packed_t packed;
+    packDeck(pRef, &packed);
+
+    size_t iLen = 1 + nextRandom() % 300;
+    int* pKey = malloc(iLen * sizeof(int));
+    for (size_t i = 0; i < iLen; i++)
+      pKey[i] = (int)(nextRandom() % 26) + 1;
+
+    refKeySchedule(pRef, pKey, iLen);
+    for (size_t i = 0; i < iLen; i++)
+      packedKeyStep(&packed, pKey[i]);
+    gChecks++;
+    if (!sameDeck(pRef, &packed))
+      fail("key schedule", "packed", c, "deck order differs");
+
+    free(pKey);
+    freeDeck(pRef);
+  }
+}
+
+/* End-to-end cipher() against the reference keystream, and decryption back to the plaintext */
+void checkCipher(unsigned nCases)
+{
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    deck_t* pRef = makeStandardDeck();
+    randomDeck(pRef);
+    deck_t* pDeck = copyDeck(pRef);
+    deck_t* pStart = copyDeck(pRef);
+
+    size_t iLen = 1 + nextRandom() % 999;
+    char* pPlain = malloc(iLen + 1);
+    char* pExpect = malloc(iLen + 1);
+    for (size_t i = 0; i < iLen; i++)
+      pPlain[i] = (char)('A' + nextRandom() % 26);
+    pPlain[iLen] = '\0';
+    for (size_t i = 0; i < iLen; i++)
+      pExpect[i] = combineChar(true, pPlain[i], refGenKeystream(pRef));
+    pExpect[iLen] = '\0';
+
+    char* pCipher = cipher(true, pDeck, pPlain, iLen);
+    char* pDecrypt = cipher(false, pStart, pCipher, iLen);
+    packed_t packed;
+    packDeck(pDeck, &packed);
+    gChecks++;
+    if (strcmp(pCipher, pExpect) != 0)
+      fail("cipher", "cipher()", c, "ciphertext differs");
+    else if (!sameDeck(pRef, &packed))
+      fail("cipher", "cipher()", c, "ending deck differs");
+    else if (strcmp(pDecrypt, pPlain) != 0)
+      fail("cipher", "cipher()", c, "decryption differs");
+
+    free(pPlain);
+    free(pExpect);
+    free(pCipher);
+    free(pDecrypt);
+    freeDeck(pRef);
+    freeDeck(pDeck);
+    freeDeck(pStart);
+  }
+}
+
+/* 5-bit packing round trips at every bit offset, for every packer this CPU supports. Each packer's bits
+   must match the scalar packer's exactly. */
+void checkPack(unsigned nCases)
+{
+  size_t nPackers = 0;
+  const packer_t* pPackers = packerList(&nPackers);
+  const packer_t* pScalar = &pPackers[nPackers - 1];
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    size_t iLen = 1 + nextRandom() % 3000;
+    unsigned char* pValues = malloc(iLen);
+    unsigned char* pExpect = malloc(PACKED_SIZE(iLen));
+    unsigned char* pPacked = malloc(PACKED_SIZE(iLen));
+    unsigned char* pGot = malloc(iLen);
+    for (size_t i = 0; i < iLen; i++)
+      pValues[i] = (unsigned char)(nextRandom() % 32);
+    pScalar->pack(pValues, iLen, pExpect);
+
+    for (size_t p = 0; p < nPackers; p++)
+    {
+      if (!pPackers[p].supported())
+        continue;
+
+      pPackers[p].pack(pValues, iLen, pPacked);
+      gChecks++;
+      if (memcmp(pExpect, pPacked, PACKED_SIZE(iLen)) != 0)
+        fail("pack5", pPackers[p].pName, c, "packed bits differ");
+
+      size_t iFirst = nextRandom() % iLen;
+      pPackers[p].unpack(pPacked + iFirst * 5 / 8, iFirst * 5 % 8, iLen - iFirst, pGot);
+      gChecks++;
+      if (memcmp(pValues + iFirst, pGot, iLen - iFirst) != 0)
+        fail("unpack5", pPackers[p].pName, c, "unpacked values differ");
+    }
+
+    free(pValues);
+    free(pExpect);
+    free(pPacked);
+    free(pGot);
+  }
+}
+
+/* The reduced-deck rules used by solitaire-solve, run on a full deck, against the reference keystream */
+void checkMini(unsigned nCases)
+{
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    deck_t* pRef = makeStandardDeck();
+    randomDeck(pRef);
+    packed_t packed;
+    packDeck(pRef, &packed);
+
+    for (unsigned i = 0; i < 500; i++)
+    {
+      int iExpect = refGenKeystream(pRef);
+      unsigned iGot = miniKeystream(packed.cards, DECK_SIZE);
+      if ((unsigned)iExpect != iGot)
+      {
+        fail("mini", "mini", c, "keystream differs");
+        break;
+      }
+    }
+    gChecks++;
+    if (!sameDeck(pRef, &packed))
+      fail("mini", "mini", c, "final deck differs");
+    freeDeck(pRef);
+  }
+}
+
+/* streamKeySchedule() on keys spanning several read chunks against keyToPacked() on the same text.
+   A completed schedule must remove its state file, and a state holding an impossible deck must be refused. */
+void checkStreamSchedule(unsigned nCases)
+{
+  char keyFile[] = "/tmp/solitaire-check-XXXXXX";
+  int fd = mkstemp(keyFile);
+  if (fd < 0)
+  {
+    fail("stream schedule", "file", 0, "unable to create a temporary key file");
+    return;
+  }
+  close(fd);
+  size_t iStateLen = strlen(keyFile) + 7;
+  char* pStateFile = malloc(iStateLen);
+  snprintf(pStateFile, iStateLen, "%s.state", keyFile);
+
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    size_t iLen = 1 + nextRandom() % 200000; // Up to three 64 KiB chunks
+    char* pKey = malloc(iLen + 1);
+    for (size_t i = 0; i < iLen; i++)
+    {
+      unsigned iChar = (unsigned)(nextRandom() % 30);
+      pKey[i] = iChar < 26 ? (char)('a' + iChar) : " ,.\n"[iChar - 26];
+    }
+    pKey[0] = 'K'; // At least one letter
+    pKey[iLen] = '\0';
+
+    FILE* f = fopen(keyFile, "wb");
+    bool bWritten = f != NULL && fwrite(pKey, 1, iLen, f) == iLen;
+    if (f != NULL)
+      bWritten = fclose(f) == 0 && bWritten;
+
+    packed_t expect;
+    packed_t got;
+    keyToPacked(pKey, false, &expect);
+    gChecks++;
+    if (!bWritten || !streamKeySchedule(keyFile, c % 2 == 0 ? NULL : pStateFile, &got))
+      fail("stream schedule", "file", c, "schedule failed");
+    else if (memcmp(expect.cards, got.cards, DECK_SIZE) != 0)
+      fail("stream schedule", "file", c, "deck order differs");
+    gChecks++;
+    if (access(pStateFile, F_OK) == 0)
+      fail("stream schedule", "file", c, "state file left after the schedule completed");
+    free(pKey);
+  }
+
+  // A card numbered past the deck would index past CUT_VALUE if resumed
+  scheduleState_t state;
+  memset(&state, 0, sizeof(state));
+  memcpy(state.magic, SCHEDULE_MAGIC, sizeof(state.magic));
+  standardPacked((packed_t*)state.cards);
+  state.cards[0] = 200;
+  FILE* f = fopen(pStateFile, "wb");
+  if (f != NULL)
+  {
+    fwrite(&state, sizeof(state), 1, f);
+    fclose(f);
+  }
+  packed_t got;
+  gChecks++;
+  if (streamKeySchedule(keyFile, pStateFile, &got))
+    fail("stream schedule", "state", 0, "impossible deck in the state was accepted");
+
+  remove(pStateFile);
+  remove(keyFile);
+  free(pStateFile);
+}
+
+/* runDirectory() on more files than it keeps in flight, split over a subdirectory, against cipherSummary()
+   on each file's lines */
+void checkDirectory(unsigned nFiles)
+{
+  char root[] = "/tmp/solitaire-check-XXXXXX";
+  if (mkdtemp(root) == NULL)
+  {
+    fail("directory", "dir", 0, "unable to create a temporary directory");
+    return;
+  }
+  char pPath[256];
+  snprintf(pPath, sizeof(pPath), "%s/in", root);
+  mkdir(pPath, 0700);
+  snprintf(pPath, sizeof(pPath), "%s/in/sub", root);
+  mkdir(pPath, 0700);
+
+  char** pExpect = calloc(nFiles, sizeof(char*));
+  for (unsigned i = 0; i < nFiles; i++)
+  {
+    char pText[64];
+    char pKey[128];
+    snprintf(pText, sizeof(pText), "Message number %u", i);
+    size_t iKeyLen = 64 + nextRandom() % 40;
+    for (size_t k = 0; k < iKeyLen; k++)
+      pKey[k] = (char)('A' + nextRandom() % 26);
+    pKey[iKeyLen] = '\0';
+    pExpect[i] = cipherSummary(pText, pKey, true, false);
+
+    snprintf(pPath, sizeof(pPath), "%s/in/%s%u", root, i % 3 == 0 ? "sub/" : "", i);
+    FILE* f = fopen(pPath, "w");
+    if (f != NULL)
+    {
+      fprintf(f, "%s\n%s\n", pText, pKey);
+      fclose(f);
+    }
+  }
+
+  char pInput[64];
+  char pOutput[64];
+  snprintf(pInput, sizeof(pInput), "%s/in", root);
+  snprintf(pOutput, sizeof(pOutput), "%s/out", root);
+  gChecks++;
+  if (!runDirectory(pInput, true, false, 3, pOutput))
+    fail("directory", "dir", 0, "runDirectory failed");
+
+  for (unsigned i = 0; i < nFiles; i++)
+  {
+    snprintf(pPath, sizeof(pPath), "%s/out/%s%u", root, i % 3 == 0 ? "sub/" : "", i);
+    char pGot[4096] = { 0 };
+    FILE* f = fopen(pPath, "r");
+    size_t iRead = f != NULL ? fread(pGot, 1, sizeof(pGot) - 1, f) : 0;
+    if (f != NULL)
+      fclose(f);
+    gChecks++;
+    if (pExpect[i] == NULL || iRead != strlen(pExpect[i]) || memcmp(pGot, pExpect[i], iRead) != 0)
+      fail("directory", "dir", i, "summary differs from cipherSummary()");
+
+    remove(pPath);
+    snprintf(pPath, sizeof(pPath), "%s/in/%s%u", root, i % 3 == 0 ? "sub/" : "", i);
+    remove(pPath);
+    free(pExpect[i]);
+  }
+  free(pExpect);
+  const char* pDirs[] = { "in/sub", "in", "out/sub", "out" };
+  for (size_t i = 0; i < sizeof(pDirs) / sizeof(pDirs[0]); i++)
+  {
+    snprintf(pPath, sizeof(pPath), "%s/%s", root, pDirs[i]);
+    rmdir(pPath);
+  }
+  rmdir(root);
+}
+
+/* cipherBytes() against keystream bytes built from the reference keystream: two values per byte, skipping
+   pairs worth 512 or more. The message is ciphered in two calls, as pipelined mode does chunk by chunk. */
+void checkBytes(unsigned nCases)
+{
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    deck_t* pRef = makeStandardDeck();
+    randomDeck(pRef);
+    packed_t start;
+    packDeck(pRef, &start);
+
+    size_t iLen = 1 + nextRandom() % 3000;
+    unsigned char* pPlain = malloc(iLen);
+    unsigned char* pExpect = malloc(iLen);
+    unsigned char* pGot = malloc(iLen);
+    for (size_t i = 0; i < iLen; i++)
+    {
+      pPlain[i] = (unsigned char)nextRandom();
+      unsigned iValue = 0;
+      do
+      {
+        iValue = (unsigned)(refGenKeystream(pRef) - 1) * 26;
+        iValue += (unsigned)(refGenKeystream(pRef) - 1);
+      }
+      while (iValue >= 512);
+      pExpect[i] = (unsigned char)(pPlain[i] + iValue);
+    }
+
+    packed_t packed = start;
+    size_t iSplit = nextRandom() % (iLen + 1);
+    cipherBytes(true, &packed, pPlain, pGot, iSplit);
+    cipherBytes(true, &packed, pPlain + iSplit, pGot + iSplit, iLen - iSplit);
+    gChecks++;
+    if (memcmp(pGot, pExpect, iLen) != 0)
+      fail("bytes", "cipherBytes()", c, "ciphertext differs");
+    else if (!sameDeck(pRef, &packed))
+      fail("bytes", "cipherBytes()", c, "ending deck differs");
+    else
+    {
+      packed = start;
+      cipherBytes(false, &packed, pGot, pGot, iLen);
+      if (memcmp(pGot, pPlain, iLen) != 0)
+        fail("bytes", "cipherBytes()", c, "decryption differs");
+    }
+
+    free(pPlain);
+    free(pExpect);
+    free(pGot);
+    freeDeck(pRef);
+  }
+}
+
+/* Pads from generatePad() used through runPad() against the reference keystream from the same offset, then
+   decrypted back. Each case is a fresh pad, so its usage file is removed first. */
+void checkPad(unsigned nCases)
+{
+  char root[] = "/tmp/solitaire-check-XXXXXX";
+  if (mkdtemp(root) == NULL)
+  {
+    fail("pad", "file", 0, "unable to create a temporary directory");
+    return;
+  }
+  char pKeyFile[64];
+  char pPadFile[64];
+  char pUsageFile[64];
+  char pInput[64];
+  char pOutput[64];
+  snprintf(pKeyFile, sizeof(pKeyFile), "%s/key", root);
+  snprintf(pPadFile, sizeof(pPadFile), "%s/pad", root);
+  snprintf(pUsageFile, sizeof(pUsageFile), "%s/pad.used", root);
+  snprintf(pInput, sizeof(pInput), "%s/in", root);
+  snprintf(pOutput, sizeof(pOutput), "%s/out", root);
+
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    char pKey[128];
+    size_t iKeyLen = 64 + nextRandom() % 40;
+    for (size_t k = 0; k < iKeyLen; k++)
+      pKey[k] = (char)('A' + nextRandom() % 26);
+    pKey[iKeyLen] = '\0';
+    FILE* f = fopen(pKeyFile, "w");
+    if (f != NULL)
+    {
+      fprintf(f, "%s\n", pKey);
+      fclose(f);
+    }
+
+    uint64_t iPadOffset = nextRandom() % 500;
+    uint64_t iCount = 100 + nextRandom() % 3000;
+    size_t iLen = 1 + nextRandom() % 100;
+    uint64_t iOffset = iPadOffset + nextRandom() % (iCount - iLen + 1);
+    char* pPlain = malloc(iLen + 1);
+    char* pExpect = malloc(iLen + 1);
+    for (size_t i = 0; i < iLen; i++)
+      pPlain[i] = (char)('A' + nextRandom() % 26);
+    pPlain[iLen] = '\0';
+
+    packed_t packed;
+    keyToPacked(pKey, false, &packed);
+    deck_t* pRef = makeStandardDeck();
+    unpackDeck(&packed, pRef);
+    for (uint64_t i = 0; i < iOffset; i++)
+      refGenKeystream(pRef);
+    for (size_t i = 0; i < iLen; i++)
+      pExpect[i] = combineChar(true, pPlain[i], refGenKeystream(pRef));
+    pExpect[iLen] = '\0';
+
+    remove(pUsageFile);
+    gChecks++;
+    if (!generatePad(pKeyFile, false, iPadOffset, iCount, pPadFile))
+      fail("pad", "generatePad()", c, "pad generation failed");
+    else
+    {
+      f = fopen(pInput, "w");
+      if (f != NULL)
+      {
+        fprintf(f, "%s\n", pPlain);
+        fclose(f);
+      }
+      char* pSummary = runPad(pInput, pPadFile, iOffset, true, pOutput) ? readWhole(pOutput, NULL) : NULL;
+      char* pCipher = outputText(pSummary);
+      free(pSummary);
+      if (pCipher == NULL)
+        fail("pad", "runPad()", c, "encryption failed");
+      else if (strcmp(pCipher, pExpect) != 0)
+        fail("pad", "runPad()", c, "ciphertext differs from the reference keystream");
+      else
+      {
+        f = fopen(pInput, "w");
+        if (f != NULL)
+        {
+          fprintf(f, "%s\n", pCipher);
+          fclose(f);
+        }
+        pSummary = runPad(pInput, pPadFile, iOffset, false, pOutput) ? readWhole(pOutput, NULL) : NULL;
+        char* pDecrypt = outputText(pSummary);
+        if (pDecrypt == NULL || strcmp(pDecrypt, pPlain) != 0)
+          fail("pad", "runPad()", c, "decryption differs");
+        free(pSummary);
+        free(pDecrypt);
+      }
+      free(pCipher);
+    }
+
+    free(pPlain);
+    free(pExpect);
+    freeDeck(pRef);
+  }
+
+  remove(pKeyFile);
+  remove(pPadFile);
+  remove(pUsageFile);
+  remove(pInput);
+  remove(pOutput);
+  rmdir(root);
+}
+
+/* runFilter() with several workers against cipherSummary() on each record, with the odd invalid record */
+void checkFilter(unsigned nRecords)
+{
+  FILE* fIn = tmpfile();
+  FILE* fOut = tmpfile();
+  if (fIn == NULL || fOut == NULL)
+  {
+    fail("filter", "file", 0, "unable to create temporary files");
+    if (fIn != NULL)
+      fclose(fIn);
+    if (fOut != NULL)
+      fclose(fOut);
+    return;
+  }
+
+  char** pExpect = calloc(nRecords, sizeof(char*));
+  for (unsigned r = 0; r < nRecords; r++)
+  {
+    if (nextRandom() % 50 == 0)
+    {
+      fputs("no fields here\n", fIn);
+      pExpect[r] = strdup("!");
+      continue;
+    }
+    char pText[128];
+    char pKey[128];
+    randomText(pText, 1 + nextRandom() % 100);
+    size_t iKeyLen = 64 + nextRandom() % 40;
+    for (size_t k = 0; k < iKeyLen; k++)
+      pKey[k] = (char)('A' + nextRandom() % 26);
+    pKey[iKeyLen] = '\0';
+    bool bEncrypt = nextRandom() % 2 == 0;
+    fprintf(fIn, "%s\t%s\t%s\n", pText, pKey, bEncrypt ? "ek" : "dk");
+    char* pSummary = cipherSummary(pText, pKey, bEncrypt, false);
+    pExpect[r] = outputText(pSummary);
+    free(pSummary);
+  }
+  rewind(fIn);
+
+  gChecks++;
+  if (!runFilter(fIn, fOut, 3, NULL))
+    fail("filter", "runFilter()", 0, "runFilter failed");
+  rewind(fOut);
+  char* pLine = NULL;
+  size_t iLineSize = 0;
+  for (unsigned r = 0; r < nRecords; r++)
+  {
+    ssize_t iRead = getline(&pLine, &iLineSize, fOut);
+    if (iRead > 0 && pLine[iRead - 1] == '\n')
+      pLine[iRead - 1] = '\0';
+    gChecks++;
+    if (iRead < 0 || pExpect[r] == NULL || strcmp(pLine, pExpect[r]) != 0)
+      fail("filter", "runFilter()", r, "result differs from cipherSummary()");
+    free(pExpect[r]);
+  }
+  free(pExpect);
+  free(pLine);
+  fclose(fIn);
+  fclose(fOut);
+}
+
+/* Sessions continued over several sessionCipher() calls against one cipherPacked() over the whole message.
+   A record that is not a deck must be refused, as must a second open of a store file that is already open. */
+void checkSession(unsigned nCases)
+{
+  sessionStore_t* pStore = openSessionStore(NULL, 64, false);
+  if (pStore == NULL)
+  {
+    fail("session", "store", 0, "unable to open an anonymous store");
+    return;
+  }
+
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    deck_t* pDeck = makeStandardDeck();
+    randomDeck(pDeck);
+    packed_t start;
+    packDeck(pDeck, &start);
+    freeDeck(pDeck);
+
+    size_t iLen = 1 + nextRandom() % 1000;
+    char* pPlain = malloc(iLen);
+    char* pExpect = malloc(iLen);
+    char* pGot = malloc(iLen);
+    for (size_t i = 0; i < iLen; i++)
+      pPlain[i] = (char)('A' + nextRandom() % 26);
+    packed_t packed = start;
+    bool bEncrypt = c % 2 == 0;
+    cipherPacked(bEncrypt, &packed, pPlain, pExpect, iLen);
+
+    uint64_t iId = c % 64;
+    bool bOk = sessionInit(pStore, iId, &start);
+    for (size_t i = 0; bOk && i < iLen; )
+    {
+      size_t n = 1 + nextRandom() % (iLen - i);
+      bOk = sessionCipher(pStore, iId, bEncrypt, pPlain + i, pGot + i, n);
+      i += n;
+    }
+    gChecks++;
+    if (!bOk)
+      fail("session", "sessionCipher()", c, "session refused");
+    else if (memcmp(pGot, pExpect, iLen) != 0)
+      fail("session", "sessionCipher()", c, "continued output differs from a single cipher");
+    else if (memcmp(pStore->pRecords[iId].cards, packed.cards, DECK_SIZE) != 0)
+      fail("session", "sessionCipher()", c, "stored deck differs");
+
+    free(pPlain);
+    free(pExpect);
+    free(pGot);
+  }
+
+  // A repeated card would step as a deck with a card missing
+  char pText[] = "AAAAA";
+  pStore->pRecords[0].cards[1] = pStore->pRecords[0].cards[0];
+  gChecks++;
+  if (sessionCipher(pStore, 0, true, pText, pText, 5))
+    fail("session", "sessionCipher()", 0, "a record that is not a deck was used");
+  closeSessionStore(pStore);
+
+  char pFile[] = "/tmp/solitaire-check-XXXXXX";
+  int fd = mkstemp(pFile);
+  if (fd < 0)
+  {
+    fail("session", "store", 0, "unable to create a temporary store");
+    return;
+  }
+  close(fd);
+  sessionStore_t* pFirst = openSessionStore(pFile, 4, false);
+  sessionStore_t* pSecond = openSessionStore(pFile, 4, false);
+  gChecks++;
+  if (pFirst == NULL)
+    fail("session", "store", 0, "unable to open a store file");
+  else if (pSecond != NULL)
+    fail("session", "store", 0, "a store file was opened twice");
+  closeSessionStore(pFirst);
+  closeSessionStore(pSecond);
+  remove(pFile);
+}
+
+/* runContainer() round trips over more than one block, and removal of the output when decryption fails */
+void checkContainer(unsigned nCases)
+{
+  char root[] = "/tmp/solitaire-check-XXXXXX";
+  if (mkdtemp(root) == NULL)
+  {
+    fail("container", "file", 0, "unable to create a temporary directory");
+    return;
+  }
+  char pKeyFile[64];
+  char pInput[64];
+  char pBox[64];
+  char pOutput[64];
+  snprintf(pKeyFile, sizeof(pKeyFile), "%s/key", root);
+  snprintf(pInput, sizeof(pInput), "%s/in", root);
+  snprintf(pBox, sizeof(pBox), "%s/box", root);
+  snprintf(pOutput, sizeof(pOutput), "%s/out", root);
+
+  for (unsigned c = 0; c < nCases; c++)
+  {
+    char pKey[128];
+    size_t iKeyLen = 64 + nextRandom() % 40;
+    for (size_t k = 0; k < iKeyLen; k++)
+      pKey[k] = (char)('A' + nextRandom() % 26);
+    pKey[iKeyLen] = '\0';
+    FILE* f = fopen(pKeyFile, "w");
+    if (f != NULL)
+    {
+      fprintf(f, "%s\n", pKey);
+      fclose(f);
+    }
+
+    size_t iLen = 1 + nextRandom() % (3 * CONTAINER_BLOCK);
+    char* pPlain = malloc(iLen + 1);
+    randomText(pPlain, iLen);
+    f = fopen(pInput, "wb");
+    if (f != NULL)
+    {
+      fwrite(pPlain, 1, iLen, f);
+      fclose(f);
+    }
+    cleanInput(pPlain);
+
+    size_t iGot = 0;
+    char* pGot = NULL;
+    gChecks++;
+    if (!runContainer(pInput, pKeyFile, true, false, pBox))
+      fail("container", "runContainer()", c, "encryption failed");
+    else if (!runContainer(pBox, pKeyFile, false, false, pOutput) || (pGot = readWhole(pOutput, &iGot)) == NULL)
+      fail("container", "runContainer()", c, "decryption failed");
+    else if (iGot != strlen(pPlain) || memcmp(pGot, pPlain, iGot) != 0)
+      fail("container", "runContainer()", c, "decryption differs from the cleaned input");
+    free(pGot);
+    free(pPlain);
+
+    // A container cut short fails its footer, and nothing of it may be left behind
+    size_t iBox = 0;
+    char* pBoxData = readWhole(pBox, &iBox);
+    if (pBoxData != NULL && iBox > 0)
+    {
+      f = fopen(pBox, "wb");
+      if (f != NULL)
+      {
+        fwrite(pBoxData, 1, iBox - 1, f);
+        fclose(f);
+      }
+      remove(pOutput);
+      gChecks++;
+      if (runContainer(pBox, pKeyFile, false, false, pOutput))
+        fail("container", "runContainer()", c, "a truncated container was decrypted");
+      else if (access(pOutput, F_OK) == 0)
+        fail("container", "runContainer()", c, "output left after a failed decryption");
+    }
+    free(pBoxData);
+  }
+
+  remove(pKeyFile);
+  remove(pInput);
+  remove(pBox);
+  remove(pOutput);
+  rmdir(root);
+}
@@ -1,14 +1,18 @@
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
 #include <string.h>
 
 #include "cipher.h"
+#include "engine.h"
 #include "file.h"
+#include "trace.h"
 
-char* cipher(bool bEncrypt, deck_t* pDeck, char* pCipher, size_t iLen);
-bool writeOutput(char* pOutput, bool bEncrypt, char* pCleanInput, char* pCleanKey, deck_t* pInputDeck, deck_t* pOutputDeck, char* pCipher);
-int genKeystream(deck_t* pDeck);
+#define KEYSTREAM_BLOCK 256 // Keystream values generated per engine call
+
+bool writeOutput(char* pOutput, char* pSummary);
+char* formatOutput(bool bEncrypt, char* pCleanInput, char* pCleanKey, deck_t* pInputDeck, deck_t* pOutputDeck, char* pCipher);
 int charToInt(char c);
 char intToChar(int i);
 
@@ -20,15 +24,42 @@ bool run(char* pInput, bool bEncrypt, bool isDeck, char* pOutput)
 {
   char* pRawInput = NULL;
   char* pRawKey = NULL;
-  if (!parseFile(pInput, &pRawInput, &pRawKey))
+  traceBegin("parseFile");
+  bool bParsed = parseFile(pInput, &pRawInput, &pRawKey);
+  traceEnd("parseFile");
+  if (!bParsed)
+    return false;
+
+  char* pSummary = cipherSummary(pRawInput, pRawKey, bEncrypt, isDeck);
+  free(pRawInput);
+  free(pRawKey);
+  if (pSummary == NULL)
     return false;
 
+  // Create output file
+  if (pOutput == NULL)
+    pOutput = "output.txt";
+
+  traceBegin("writeOutput");
+  bool bWritten = writeOutput(pOutput, pSummary);
+  traceEnd("writeOutput");
+  free(pSummary);
+  return bWritten;
+}
+
+/* Cipher the first line of an input file, pRawInput, with its second line, pRawKey (see parseFile()).
+   If pRawKey is NULL, a random deck is used when encrypting.
+   Set bEncrypt to true to encrypt the text, false to decrypt it.
+   Set isDeck to true if a deck is to be used, false if key text is to be used.
+   Returns the allocated, null-terminated summary that run() writes to its output file,
+   or NULL if the text or key/deck was invalid. */
+char* cipherSummary(const char* pRawInput, const char* pRawKey, bool bEncrypt, bool isDeck)
+{
   // If no key is given and we're trying to decrypt, fail the calculation
   if (pRawKey == NULL && !bEncrypt)
   {
     fprintf(stderr, "Unable to decrypt, key/deck was empty.\n");
-    free(pRawInput);
-    return false;
+    return NULL;
   }
 
   // Clean the input text
@@ -36,14 +67,14 @@ bool run(char* pInput, bool bEncrypt, bool isDeck, char* pOutput)
   size_t iLen = strlen(pRawInput) + 1;
   pCleanInput = malloc(iLen * sizeof(char));
   strncpy(pCleanInput, pRawInput, iLen);
+  traceBegin("clean");
   cleanInput(pCleanInput);
+  traceEnd("clean");
   if (strlen(pCleanInput) == 0)
   {
     fprintf(stderr, "Input text '%s' did not contain any alpha characters.\n", pRawInput);
-    free(pRawInput);
-    free(pRawKey);
     free(pCleanInput);
-    return false;
+    return NULL;
   }
 
   // Clean the input key (pRawKey), if provided, and transform it into an allocated deck (pDeck)
@@ -55,27 +86,13 @@ bool run(char* pInput, bool bEncrypt, bool isDeck, char* pOutput)
     pCleanKey = malloc(iCleanLen * sizeof(char));
     strncpy(pCleanKey, pRawKey, iCleanLen);
 
-    int* pDeckKey = NULL;
-    if (isDeck)
-      iCleanLen = cleanDeckKey(pCleanKey, &pDeckKey);
-    else
-      iCleanLen = cleanAlphaKey(pCleanKey, &pDeckKey);
-
-    if (iCleanLen == 0)
+    pDeck = keyToDeck(pCleanKey, isDeck);
+    if (pDeck == NULL)
     {
-      free(pRawInput);
-      free(pRawKey);
       free(pCleanInput);
       free(pCleanKey);
-      return false;
+      return NULL;
     }
-
-    if (isDeck)
-      pDeck = makeDeckFromInt(pDeckKey, iCleanLen);
-    else
-      pDeck = makeDeckFromKey(pDeckKey, iCleanLen);
-
-    free(pDeckKey);
   }
   
   // If no input deck/key was provided, create a random, shuffled deck of cards
@@ -97,22 +114,81 @@ bool run(char* pInput, bool bEncrypt, bool isDeck, char* pOutput)
   char* pCipher = cipher(bEncrypt, pDeck, pCleanInput, strlen(pCleanInput));
   assert(pCipher != NULL);
 
-  // Create output file
-  if (pOutput == NULL)
-    pOutput = "output.txt";
-
-  if (!writeOutput(pOutput, bEncrypt, pCleanInput, (isDeck ? NULL : pCleanKey), pInputDeck, pDeck, pCipher))
-    return false;
+  char* pSummary = formatOutput(bEncrypt, pCleanInput, (isDeck ? NULL : pCleanKey), pInputDeck, pDeck, pCipher);
 
   // Free all memory
-  free(pRawInput);
-  free(pRawKey);
   free(pCleanInput);
   free(pCleanKey);
   free(pCipher);
   freeDeck(pInputDeck);
   freeDeck(pDeck);
 
+  return pSummary;
+}
+
+/* Clean the raw key text pKey in place and transform it into an allocated deck.
+   Set isDeck to true if pKey is an explicit deck order, false if it is key text.
+   Returns NULL if the key/deck was invalid. */
+deck_t* keyToDeck(char* pKey, bool isDeck)
+{
+  traceBegin("key schedule");
+  int* pDeckKey = NULL;
+  size_t iCleanLen = 0;
+  if (isDeck)
+    iCleanLen = cleanDeckKey(pKey, &pDeckKey);
+  else
+    iCleanLen = cleanAlphaKey(pKey, &pDeckKey);
+
+  deck_t* pDeck = NULL;
+  if (iCleanLen > 0)
+  {
+    if (isDeck)
+      pDeck = makeDeckFromInt(pDeckKey, iCleanLen);
+    else
+      pDeck = makeDeckFromKey(pDeckKey, iCleanLen);
+    free(pDeckKey);
+  }
+  traceEnd("key schedule");
+  return pDeck;
+}
+
+/* Transform the raw key text pKey (not modified) straight into a packed deck without any intermediate deck_t.
+   Set isDeck to true if pKey is an explicit deck order, false if it is key text.
+   Unlike keyToDeck(), no warning is printed for short keys. Returns false if the key/deck was invalid. */
+bool keyToPacked(const char* pKey, bool isDeck, packed_t* pPacked)
+{
+  if (isDeck)
+  {
+    size_t iLen = strlen(pKey) + 1;
+    char* pCopy = malloc(iLen * sizeof(char));
+    strncpy(pCopy, pKey, iLen);
+    int* pDeckKey = NULL;
+    size_t iCleanLen = cleanDeckKey(pCopy, &pDeckKey);
+    free(pCopy);
+    if (iCleanLen == 0)
+      return false;
+
+    for (size_t i = 0; i < DECK_SIZE; i++)
+      pPacked->cards[i] = (unsigned char)pDeckKey[i];
+    free(pDeckKey);
+    return true;
+  }
+
+  standardPacked(pPacked);
+  size_t iCleanLen = 0;
+  for (const char* p = pKey; *p != '\0'; p++)
+  {
+    if (isalpha((unsigned char)*p))
+    {
+      packedKeyStep(pPacked, (size_t)(toupper((unsigned char)*p) - 'A' + 1));
+      iCleanLen++;
+    }
+  }
+  if (iCleanLen == 0)
+  {
+    fprintf(stderr, "Input key '%s' was not a string of alphabetical characters.\n", pKey);
+    return false;
+  }
   return true;
 }
 
@@ -122,28 +198,94 @@ bool run(char* pInput, bool bEncrypt, bool isDeck, char* pOutput)
 char* cipher(bool bEncrypt, deck_t* pDeck, char* pCipher, size_t iLen)
 {
   char* pOutput = malloc((iLen + 1) * sizeof(char)); // Add 1 for \0
-  int iResult = -1;
-  int iKey = -1;
-  for (size_t i = 0; i < iLen; i++)
+  cipherBuffer(bEncrypt, pDeck, pCipher, pOutput, iLen);
+  pOutput[iLen] = '\0';
+  return pOutput;
+}
+
+/* Encode/decode iLen cleaned chars of pInput into pOutput, advancing pDeck.
+   pInput and pOutput may be the same buffer. Neither needs to be null-terminated. */
+void cipherBuffer(bool bEncrypt, deck_t* pDeck, char* pInput, char* pOutput, size_t iLen)
+{
+  // Run the keystream on a packed copy of the deck, then copy the final order back
+  traceBegin("keystream");
+  packed_t packed;
+  packDeck(pDeck, &packed);
+  cipherPacked(bEncrypt, &packed, pInput, pOutput, iLen);
+  unpackDeck(&packed, pDeck);
+  traceEnd("keystream");
+}
+
+/* Encode/decode iLen cleaned chars of pInput into pOutput, advancing the packed deck pPacked */
+void cipherPacked(bool bEncrypt, packed_t* pPacked, char* pInput, char* pOutput, size_t iLen)
+{
+  // Keystream comes from the selected engine a block at a time
+  unsigned char pKeys[KEYSTREAM_BLOCK];
+  for (size_t i = 0; i < iLen; i += KEYSTREAM_BLOCK)
   {
-    iKey = genKeystream(pDeck);
-    if (bEncrypt) // Encryption adds the keystream to the text
-    {
-      iResult = charToInt(pCipher[i]) + iKey;
-      pOutput[i] = intToChar(iResult > 26 ? (iResult - 26) : iResult);
-    }
-    else // Decryption subtracts the keystream from the text
+    size_t iBlock = iLen - i < KEYSTREAM_BLOCK ? iLen - i : KEYSTREAM_BLOCK;
+    engineKeystream(pPacked, pKeys, iBlock);
+    for (size_t j = 0; j < iBlock; j++)
+      pOutput[i + j] = combineChar(bEncrypt, pInput[i + j], pKeys[j]);
+  }
+}
+
+/* Return the next keystream byte. Two keystream values form a number from 0 to 675;
+   values of 512 or more are rejected so the low 8 bits are uniformly distributed. */
+unsigned char byteKeystream(packed_t* pPacked)
+{
+  unsigned iValue = 0;
+  do
+  {
+    iValue = (unsigned)(packedKeystream(pPacked) - 1) * 26;
+    iValue += (unsigned)(packedKeystream(pPacked) - 1);
+  }
+  while (iValue >= 512);
+  return (unsigned char)iValue;
+}
+
+/* Encode/decode iLen raw bytes of pInput into pOutput by adding/subtracting keystream bytes mod 256.
+   pInput and pOutput may be the same buffer. The bytes are those of byteKeystream(), drawn from the
+   selected engine a block at a time. */
+void cipherBytes(bool bEncrypt, packed_t* pPacked, unsigned char* pInput, unsigned char* pOutput, size_t iLen)
+{
+  // Each byte takes at least one pair of values, so asking for two per byte still owed never draws
+  // past the last pair used and the deck ends where byteKeystream() would leave it
+  unsigned char pKeys[KEYSTREAM_BLOCK];
+  size_t i = 0;
+  while (i < iLen)
+  {
+    size_t nValues = iLen - i < KEYSTREAM_BLOCK / 2 ? 2 * (iLen - i) : KEYSTREAM_BLOCK;
+    engineKeystream(pPacked, pKeys, nValues);
+    for (size_t j = 0; j < nValues; j += 2)
     {
-      iResult = charToInt(pCipher[i]) - iKey;
-      pOutput[i] = intToChar(iResult <= 0 ? (iResult + 26) : iResult);
+      unsigned iValue = (unsigned)(pKeys[j] - 1) * 26 + (unsigned)(pKeys[j + 1] - 1);
+      if (iValue >= 512)
+        continue;
+      pOutput[i] = bEncrypt ? (unsigned char)(pInput[i] + iValue) : (unsigned char)(pInput[i] - iValue);
+      i++;
     }
   }
-  pOutput[iLen] = '\0';
-  return pOutput;
 }
 
-/* Write the summary to an ouptut file 'pOutput' */
-bool writeOutput(char* pOutput, bool bEncrypt, char* pCleanInput, char* pCleanKey, deck_t* pInputDeck, deck_t* pOutputDeck, char* pCipher)
+/* Combine a single cleaned char with a keystream value from 1-26 */
+char combineChar(bool bEncrypt, char c, int iKey)
+{
+  int iResult = -1;
+  if (bEncrypt) // Encryption adds the keystream to the text
+  {
+    iResult = charToInt(c) + iKey;
+    return intToChar(iResult > 26 ? (iResult - 26) : iResult);
+  }
+  else // Decryption subtracts the keystream from the text
+  {
+    iResult = charToInt(c) - iKey;
+    return intToChar(iResult <= 0 ? (iResult + 26) : iResult);
+  }
+}
+
+/* Write the summary text pSummary to an output file 'pOutput' */
+bool writeOutput(char* pOutput, char* pSummary)
 {
   FILE* f = fopen(pOutput, "w");
   if (f == NULL)
@@ -152,6 +294,24 @@ bool writeOutput(char* pOutput, bool bEncrypt, char* pCleanInput, char* pCleanKe
     return false;
   }
 
+  fputs(pSummary, f);
+
+  if (fclose(f) != 0)
+  {
+    fprintf(stderr, "Error closing output file '%s': %s\n", pOutput, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+/* Format the summary written to an output file as an allocated, null-terminated string */
+char* formatOutput(bool bEncrypt, char* pCleanInput, char* pCleanKey, deck_t* pInputDeck, deck_t* pOutputDeck, char* pCipher)
+{
+  char* pSummary = NULL;
+  size_t iSize = 0;
+  FILE* f = open_memstream(&pSummary, &iSize);
+  assert(f != NULL);
+
   // pCleanInput and pCipher are both null-terminated
   fputs(bEncrypt ? "Encrypt Mode\n" : "Decrypt Mode\n", f);
   fputs("Cleaned input text: '", f);
@@ -180,15 +340,12 @@ bool writeOutput(char* pOutput, bool bEncrypt, char* pCleanInput, char* pCleanKe
   fputs(pCipher, f);
   fputs("'\n", f);
 
-  if (fclose(f) != 0)
-  {
-    fprintf(stderr, "Error closing output file '%s': %s\n", pOutput, strerror(errno));
-    return false;
-  }
-  return true;
+  fclose(f);
+  return pSummary;
 }
 
 /* Given a deck of cards, return the next value for encryption.
+   This is the reference implementation; packedKeystream() is the fast equivalent used by cipherBuffer().
    The method is:
    1. Move "A" and "B" Jokers
    2. Perform triple cut
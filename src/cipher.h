@@ -1,4 +1,15 @@
 #include <stdbool.h>
 #include "deck.h"
+#include "packed.h"
 
 bool run(char* pInput, bool bEncrypt, bool isDeck, char* pOutput);
+char* cipherSummary(const char* pRawInput, const char* pRawKey, bool bEncrypt, bool isDeck);
+deck_t* keyToDeck(char* pKey, bool isDeck);
+bool keyToPacked(const char* pKey, bool isDeck, packed_t* pPacked);
+char* cipher(bool bEncrypt, deck_t* pDeck, char* pCipher, size_t iLen);
+void cipherBuffer(bool bEncrypt, deck_t* pDeck, char* pInput, char* pOutput, size_t iLen);
+char combineChar(bool bEncrypt, char c, int iKey);
+void cipherPacked(bool bEncrypt, packed_t* pPacked, char* pInput, char* pOutput, size_t iLen);
+unsigned char byteKeystream(packed_t* pPacked);
+void cipherBytes(bool bEncrypt, packed_t* pPacked, unsigned char* pInput, unsigned char* pOutput, size_t iLen);
+int genKeystream(deck_t* pDeck);
@@ -0,0 +1,368 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cipher.h"
+#include "container.h"
+#include "engine.h"
+#include "file.h"
+#include "pack.h"
+#include "trace.h"
+
+#define CHUNK_SIZE (1 << 20) // Bytes of plaintext read at a time
+#define STRIP 256            // Letters combined per keystream call; a multiple of 8
+
+static bool packContainer(FILE* fIn, FILE* fOut, packed_t* pPacked);
+static bool unpackContainer(FILE* fIn, FILE* fOut, packed_t* pPacked);
+static bool writeBlock(FILE* fOut, const unsigned char* pValues, size_t nLetters, unsigned char* pPacked,
+                       containerIndex_t** pIndex, size_t* pBlocks);
+static uint32_t checksum(const unsigned char* pData, size_t iLen);
+static void putLe32(unsigned char* pOut, uint32_t iValue);
+static void putLe64(unsigned char* pOut, uint64_t iValue);
+static uint32_t getLe32(const unsigned char* pIn);
+static uint64_t getLe64(const unsigned char* pIn);
+static bool writeHeader(FILE* fOut, const containerHeader_t* pHeader);
+static bool readHeader(FILE* fIn, containerHeader_t* pHeader);
+static bool writeIndex(FILE* fOut, const containerIndex_t* pIndex, size_t nBlocks);
+static bool readIndex(FILE* fIn, containerIndex_t* pIndex, size_t nBlocks);
+static bool writeFooter(FILE* fOut, const containerFooter_t* pFooter);
+static bool readFooter(FILE* fIn, containerFooter_t* pFooter);
+
+/* Encrypt the whole of pInput into a packed 5-bit container, or decrypt a container back to the cleaned text.
+   As in pipelined mode, the deck/key is read from the first line of pKeyFile and isDeck selects between a deck
+   order and key text. Decryption unpacks each block a strip at a time straight into the combine step, so the
+   ciphertext is never expanded to one byte per letter. If pOutput is NULL, 'output.box' is written when
+   encrypting and 'output.txt' when decrypting. */
+bool runContainer(char* pInput, char* pKeyFile, bool bEncrypt, bool isDeck, char* pOutput)
+{
+  if (pKeyFile == NULL)
+  {
+    fprintf(stderr, "Container mode requires a key file.\n");
+    return false;
+  }
+
+  char* pKey = NULL;
+  if (!parseKeyFile(pKeyFile, &pKey))
+    return false;
+
+  packed_t packed;
+  bool bOk = keyToPacked(pKey, isDeck, &packed);
+  free(pKey);
+  if (!bOk)
+  {
+    fprintf(stderr, "Invalid key/deck in key file '%s'.\n", pKeyFile);
+    return false;
+  }
+
+  if (pOutput == NULL)
+    pOutput = bEncrypt ? "output.box" : "output.txt";
+
+  FILE* fIn = fopen(pInput, "rb");
+  if (fIn == NULL)
+  {
+    fprintf(stderr, "Error opening file '%s': %s.\n", pInput, strerror(errno));
+    return false;
+  }
+  FILE* fOut = fopen(pOutput, "wb");
+  if (fOut == NULL)
+  {
+    fprintf(stderr, "Unable to create output file '%s': %s\n", pOutput, strerror(errno));
+    fclose(fIn);
+    return false;
+  }
+
+  bOk = bEncrypt ? packContainer(fIn, fOut, &packed) : unpackContainer(fIn, fOut, &packed);
+  if (!bEncrypt && !bOk)
+    fprintf(stderr, "Unable to decrypt container '%s'.\n", pInput);
+
+  fclose(fIn);
+  if (fclose(fOut) != 0)
+  {
+    fprintf(stderr, "Error closing output file '%s': %s\n", pOutput, strerror(errno));
+    bOk = false;
+  }
+
+  // Leave no partial or unverified output behind
+  if (!bOk)
+    remove(pOutput);
+  return bOk;
+}
+
+/* Clean and encrypt fIn, packing the ciphertext into blocks of CONTAINER_BLOCK letters.
+   Fails if fIn holds no letters. */
+static bool packContainer(FILE* fIn, FILE* fOut, packed_t* pPacked)
+{
+  containerHeader_t header = { CONTAINER_MAGIC, CONTAINER_BLOCK, 0 };
+  bool bOk = writeHeader(fOut, &header);
+
+  char* pChunk = malloc(CHUNK_SIZE);
+  unsigned char* pValues = malloc(CONTAINER_BLOCK);
+  unsigned char* pBlock = malloc(PACKED_SIZE(CONTAINER_BLOCK));
+  unsigned char pKeys[STRIP];
+  containerIndex_t* pIndex = NULL;
+  size_t nBlocks = 0;
+  size_t nValues = 0;
+  uint64_t nLetters = 0;
+  size_t iRead = 0;
+  while (bOk && (iRead = fread(pChunk, 1, CHUNK_SIZE, fIn)) > 0)
+  {
+    size_t iLen = cleanBuffer(pChunk, iRead);
+    for (size_t i = 0; bOk && i < iLen; )
+    {
+      size_t n = iLen - i;
+      if (n > STRIP)
+        n = STRIP;
+      if (n > CONTAINER_BLOCK - nValues)
+        n = CONTAINER_BLOCK - nValues;
+
+      // The combine step of combineChar(), producing the letter's value 0-25 instead of the letter
+      engineKeystream(pPacked, pKeys, n);
+      for (size_t j = 0; j < n; j++)
+        pValues[nValues + j] = (unsigned char)((pChunk[i + j] - 'A' + pKeys[j]) % 26);
+      nValues += n;
+      i += n;
+
+      if (nValues == CONTAINER_BLOCK)
+      {
+        bOk = writeBlock(fOut, pValues, nValues, pBlock, &pIndex, &nBlocks);
+        nLetters += nValues;
+        nValues = 0;
+      }
+    }
+  }
+  if (ferror(fIn))
+  {
+    fprintf(stderr, "Error reading input: %s.\n", strerror(errno));
+    bOk = false;
+  }
+  if (bOk && nValues > 0)
+  {
+    bOk = writeBlock(fOut, pValues, nValues, pBlock, &pIndex, &nBlocks);
+    nLetters += nValues;
+  }
+
+  bool bEmpty = bOk && nLetters == 0;
+  if (bOk && !bEmpty)
+  {
+    containerFooter_t footer = { nLetters, nBlocks, 0, CONTAINER_MAGIC };
+    off_t iIndexOffset = ftello(fOut);
+    footer.iIndexOffset = (uint64_t)iIndexOffset;
+    bOk = iIndexOffset >= 0 && writeIndex(fOut, pIndex, nBlocks) && writeFooter(fOut, &footer);
+  }
+  if (bEmpty)
+    fprintf(stderr, "Input text did not contain any alpha characters.\n");
+  else if (!bOk)
+    fprintf(stderr, "Error writing container.\n");
+  bOk = bOk && !bEmpty;
+
+  free(pChunk);
+  free(pValues);
+  free(pBlock);
+  free(pIndex);
+  return bOk;
+}
+
+/* Pack nLetters values into pPacked, write them and add the block to the index */
+static bool writeBlock(FILE* fOut, const unsigned char* pValues, size_t nLetters, unsigned char* pPacked,
+                       containerIndex_t** pIndex, size_t* pBlocks)
+{
+  traceBegin("pack block");
+  pack5(pValues, nLetters, pPacked);
+  traceEnd("pack block");
+
+  off_t iOffset = ftello(fOut);
+  if (iOffset < 0)
+    return false;
+
+  *pIndex = realloc(*pIndex, (*pBlocks + 1) * sizeof(containerIndex_t));
+  containerIndex_t* pEntry = &(*pIndex)[(*pBlocks)++];
+  pEntry->iOffset = (uint64_t)iOffset;
+  pEntry->nLetters = (uint32_t)nLetters;
+  pEntry->iChecksum = checksum(pPacked, PACKED_SIZE(nLetters));
+  return fwrite(pPacked, 1, PACKED_SIZE(nLetters), fOut) == PACKED_SIZE(nLetters);
+}
+
+/* Decrypt the container fIn to cleaned text. The footer and index are read first and checked against the
+   file, then each block is verified and decrypted in turn. */
+static bool unpackContainer(FILE* fIn, FILE* fOut, packed_t* pPacked)
+{
+  containerHeader_t header;
+  containerFooter_t footer;
+  if (!readHeader(fIn, &header) || memcmp(header.magic, CONTAINER_MAGIC, sizeof(header.magic)) != 0 ||
+      header.iBlockSize == 0 || header.iBlockSize % 8 != 0 || header.iBlockSize > (1U << 24))
+    return false;
+  if (fseeko(fIn, -(off_t)CONTAINER_FOOTER_SIZE, SEEK_END) != 0 || !readFooter(fIn, &footer) ||
+      memcmp(footer.magic, CONTAINER_MAGIC, sizeof(footer.magic)) != 0)
+    return false;
+
+  off_t iSize = ftello(fIn);
+  if (iSize < 0 || footer.iIndexOffset < CONTAINER_HEADER_SIZE || footer.nBlocks > (uint64_t)iSize / CONTAINER_INDEX_SIZE ||
+      footer.iIndexOffset + footer.nBlocks * CONTAINER_INDEX_SIZE + CONTAINER_FOOTER_SIZE != (uint64_t)iSize)
+    return false;
+
+  size_t nBlocks = (size_t)footer.nBlocks;
+  containerIndex_t* pIndex = malloc(nBlocks * sizeof(containerIndex_t) + 1);
+  bool bOk = fseeko(fIn, (off_t)footer.iIndexOffset, SEEK_SET) == 0 && readIndex(fIn, pIndex, nBlocks);
+
+  // Every block but the last is full, and the blocks lie end to end between the header and the index
+  uint64_t nLetters = 0;
+  uint64_t iExpected = CONTAINER_HEADER_SIZE;
+  for (size_t b = 0; bOk && b < nBlocks; b++)
+  {
+    bOk = pIndex[b].iOffset == iExpected && pIndex[b].nLetters > 0 && pIndex[b].nLetters <= header.iBlockSize &&
+          (b + 1 == nBlocks || pIndex[b].nLetters == header.iBlockSize);
+    nLetters += pIndex[b].nLetters;
+    iExpected += PACKED_SIZE((uint64_t)pIndex[b].nLetters);
+  }
+  bOk = bOk && nLetters == footer.nLetters && iExpected == footer.iIndexOffset;
+
+  unsigned char* pBlock = malloc(PACKED_SIZE((size_t)header.iBlockSize));
+  char* pText = malloc(header.iBlockSize);
+  unsigned char pValues[STRIP];
+  unsigned char pKeys[STRIP];
+  for (size_t b = 0; bOk && b < nBlocks; b++)
+  {
+    size_t nBlock = pIndex[b].nLetters;
+    size_t iBytes = PACKED_SIZE(nBlock);
+    bOk = fseeko(fIn, (off_t)pIndex[b].iOffset, SEEK_SET) == 0 && fread(pBlock, 1, iBytes, fIn) == iBytes;
+    if (bOk && checksum(pBlock, iBytes) != pIndex[b].iChecksum)
+    {
+      fprintf(stderr, "Block %zu failed its checksum.\n", b);
+      bOk = false;
+    }
+
+    // Unpack a strip of letters and subtract the keystream from it, as combineChar() does for decryption
+    traceBegin("unpack block");
+    for (size_t i = 0; bOk && i < nBlock; i += STRIP)
+    {
+      size_t n = nBlock - i < STRIP ? nBlock - i : STRIP;
+      unpack5(pBlock, i * 5, n, pValues);
+      engineKeystream(pPacked, pKeys, n);
+      for (size_t j = 0; j < n; j++)
+        pText[i + j] = (char)('A' + (pValues[j] + 26 - pKeys[j]) % 26);
+    }
+    traceEnd("unpack block");
+    bOk = bOk && fwrite(pText, 1, nBlock, fOut) == nBlock;
+  }
+
+  free(pIndex);
+  free(pBlock);
+  free(pText);
+  return bOk;
+}
+
+/* 32-bit FNV-1a */
+static uint32_t checksum(const unsigned char* pData, size_t iLen)
+{
+  uint32_t iHash = 2166136261u;
+  for (size_t i = 0; i < iLen; i++)
+    iHash = (iHash ^ pData[i]) * 16777619u;
+  return iHash;
+}
+
+static void putLe32(unsigned char* pOut, uint32_t iValue)
+{
+  for (size_t i = 0; i < 4; i++)
+    pOut[i] = (unsigned char)(iValue >> (8 * i));
+}
+
+static void putLe64(unsigned char* pOut, uint64_t iValue)
+{
+  for (size_t i = 0; i < 8; i++)
+    pOut[i] = (unsigned char)(iValue >> (8 * i));
+}
+
+static uint32_t getLe32(const unsigned char* pIn)
+{
+  uint32_t iValue = 0;
+  for (size_t i = 0; i < 4; i++)
+    iValue |= (uint32_t)pIn[i] << (8 * i);
+  return iValue;
+}
+
+static uint64_t getLe64(const unsigned char* pIn)
+{
+  uint64_t iValue = 0;
+  for (size_t i = 0; i < 8; i++)
+    iValue |= (uint64_t)pIn[i] << (8 * i);
+  return iValue;
+}
+
+static bool writeHeader(FILE* fOut, const containerHeader_t* pHeader)
+{
+  unsigned char bytes[CONTAINER_HEADER_SIZE];
+  memcpy(bytes, pHeader->magic, 8);
+  putLe32(bytes + 8, pHeader->iBlockSize);
+  putLe32(bytes + 12, pHeader->iFlags);
+  return fwrite(bytes, 1, sizeof(bytes), fOut) == sizeof(bytes);
+}
+
+static bool readHeader(FILE* fIn, containerHeader_t* pHeader)
+{
+  unsigned char bytes[CONTAINER_HEADER_SIZE];
+  if (fread(bytes, 1, sizeof(bytes), fIn) != sizeof(bytes))
+    return false;
+  memcpy(pHeader->magic, bytes, 8);
+  pHeader->iBlockSize = getLe32(bytes + 8);
+  pHeader->iFlags = getLe32(bytes + 12);
+  return true;
+}
+
+/* Write the index a block of entries at a time */
+static bool writeIndex(FILE* fOut, const containerIndex_t* pIndex, size_t nBlocks)
+{
+  unsigned char bytes[64 * CONTAINER_INDEX_SIZE];
+  for (size_t b = 0; b < nBlocks; )
+  {
+    size_t n = 0;
+    for (; n < 64 && b < nBlocks; n++, b++)
+    {
+      putLe64(bytes + n * CONTAINER_INDEX_SIZE, pIndex[b].iOffset);
+      putLe32(bytes + n * CONTAINER_INDEX_SIZE + 8, pIndex[b].nLetters);
+      putLe32(bytes + n * CONTAINER_INDEX_SIZE + 12, pIndex[b].iChecksum);
+    }
+    if (fwrite(bytes, CONTAINER_INDEX_SIZE, n, fOut) != n)
+      return false;
+  }
+  return true;
+}
+
+static bool readIndex(FILE* fIn, containerIndex_t* pIndex, size_t nBlocks)
+{
+  unsigned char bytes[64 * CONTAINER_INDEX_SIZE];
+  for (size_t b = 0; b < nBlocks; )
+  {
+    size_t n = nBlocks - b < 64 ? nBlocks - b : 64;
+    if (fread(bytes, CONTAINER_INDEX_SIZE, n, fIn) != n)
+      return false;
+    for (size_t i = 0; i < n; i++, b++)
+    {
+      pIndex[b].iOffset = getLe64(bytes + i * CONTAINER_INDEX_SIZE);
+      pIndex[b].nLetters = getLe32(bytes + i * CONTAINER_INDEX_SIZE + 8);
+      pIndex[b].iChecksum = getLe32(bytes + i * CONTAINER_INDEX_SIZE + 12);
+    }
+  }
+  return true;
+}
+
+static bool writeFooter(FILE* fOut, const containerFooter_t* pFooter)
+{
+  unsigned char bytes[CONTAINER_FOOTER_SIZE];
+  putLe64(bytes, pFooter->nLetters);
+  putLe64(bytes + 8, pFooter->nBlocks);
+  putLe64(bytes + 16, pFooter->iIndexOffset);
+  memcpy(bytes + 24, pFooter->magic, 8);
+  return fwrite(bytes, 1, sizeof(bytes), fOut) == sizeof(bytes);
+}
+
+static bool readFooter(FILE* fIn, containerFooter_t* pFooter)
+{
+  unsigned char bytes[CONTAINER_FOOTER_SIZE];
+  if (fread(bytes, 1, sizeof(bytes), fIn) != sizeof(bytes))
+    return false;
+  pFooter->nLetters = getLe64(bytes);
+  pFooter->nBlocks = getLe64(bytes + 8);
+  pFooter->iIndexOffset = getLe64(bytes + 16);
+  memcpy(pFooter->magic, bytes + 24, 8);
+  return true;
+}
@@ -0,0 +1,45 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CONTAINER_MAGIC "SOLBOX1"
+#define CONTAINER_BLOCK 65536 // Letters per block; a multiple of 8 so every full block packs into whole bytes
+
+/* A container file holds ciphertext letters as values 0-25, 5 bits each (see pack5()). It is laid out as
+   this header, the packed blocks, one index entry per block and a footer. Every block but the last holds
+   iBlockSize letters and starts on a byte boundary, so any block can be read and unpacked on its own.
+   On disk each structure takes the size below, with its fields in order and integers little-endian,
+   whatever the host's byte order and padding. */
+#define CONTAINER_HEADER_SIZE 16
+#define CONTAINER_INDEX_SIZE 16
+#define CONTAINER_FOOTER_SIZE 32
+
+struct containerHeader_tag
+{
+  char     magic[8];
+  uint32_t iBlockSize;
+  uint32_t iFlags; // Reserved, 0
+};
+typedef struct containerHeader_tag containerHeader_t;
+
+struct containerIndex_tag
+{
+  uint64_t iOffset;   // File offset of the block's packed letters
+  uint32_t nLetters;
+  uint32_t iChecksum; // FNV-1a of the block's packed bytes
+};
+typedef struct containerIndex_tag containerIndex_t;
+
+/* Written last, so the index can be found once the whole message has been ciphered */
+struct containerFooter_tag
+{
+  uint64_t nLetters;
+  uint64_t nBlocks;
+  uint64_t iIndexOffset;
+  char     magic[8];
+};
+typedef struct containerFooter_tag containerFooter_t;
+
+bool runContainer(char* pInput, char* pKeyFile, bool bEncrypt, bool isDeck, char* pOutput);
+#endif
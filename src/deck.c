@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include "deck.h"
+#include "packed.h"
 
 char* writeCard(card_t* pCard);
 char* writeDeck(deck_t* pCard);
@@ -82,13 +83,11 @@ deck_t* makeDeckFromKey(int* pList, size_t iLen)
     printf("It is recommended to use at least a 64 character key (at least 80 is even better).\n");
   }  
   // Follow the steps of encryption, but perform the count cut a second time using the input key
+  packed_t packed;
+  packDeck(pDeck, &packed);
   for (size_t i = 0; i < iLen; i++)
-  {
-    moveJokers(pDeck);
-    tripleCut(pDeck);
-    countCutBottom(pDeck);
-    countCutValue(pDeck, pList[i]);
-  }
+    packedKeyStep(&packed, pList[i]);
+  unpackDeck(&packed, pDeck);
   return pDeck;
 }
 
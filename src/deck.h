@@ -1,5 +1,6 @@
 #ifndef DECK_H
 #define DECK_H
+#include <stdbool.h>
 #include <stdlib.h>
 
 /* Bridge ordering: Clubs < Diamonds < Hearts < Spades */
@@ -0,0 +1,755 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cipher.h"
+#include "dir.h"
+#include "ring.h"
+#include "trace.h"
+
+#define MAX_JOBS 256      // Files in flight at once; each has at most one I/O operation queued
+#define JOB_BUFFER 2048   // Bytes read from each file; parseFile() never uses more than two 1000 byte lines
+#define LINE_LIMIT 999    // Longest line parseFile() reads in one piece (fgets with 1000 bytes)
+#define WAKE_JOB MAX_JOBS // Completion index of the io_uring read of the I/O thread's wake eventfd
+
+/* Each file moves through these states. The I/O thread queues one operation per state and
+   advances the file when it completes; JOB_CIPHER is spent with a cipher worker. */
+enum jobState_tag
+{
+  JOB_OPEN_IN,
+  JOB_READ,
+  JOB_CLOSE_IN,
+  JOB_CIPHER,
+  JOB_OPEN_OUT,
+  JOB_WRITE,
+  JOB_CLOSE_OUT
+};
+typedef enum jobState_tag jobState_t;
+
+struct job_tag
+{
+  jobState_t state;
+  size_t     iFile;
+  int        fd;
+  size_t     iLen;      // Bytes read into pBuffer
+  char*      pSummary;  // Output text from cipherSummary(), NULL if the file could not be ciphered
+  size_t     iSummaryLen;
+  size_t     iWritten;
+  char       pBuffer[JOB_BUFFER];
+};
+typedef struct job_tag job_t;
+
+/* A raw io_uring instance: the kernel's submission and completion rings mapped into this process */
+struct uring_tag
+{
+  int                  fd;
+  unsigned*            sqHead;
+  unsigned*            sqTail;
+  unsigned*            sqMask;
+  unsigned*            sqArray;
+  struct io_uring_sqe* sqes;
+  unsigned*            cqHead;
+  unsigned*            cqTail;
+  unsigned*            cqMask;
+  struct io_uring_cqe* cqes;
+  void*                pSqRing;
+  size_t               iSqRingSize;
+  void*                pCqRing;
+  size_t               iCqRingSize;
+  size_t               iSqesSize;
+  unsigned             nQueued; // Submission entries not yet passed to the kernel
+  unsigned             nReaped; // Completions taken; the kernel's submission head less this is still in flight
+};
+typedef struct uring_tag uring_t;
+
+/* Each ring has an eventfd that the pushing side bumps, so the popping side can sleep when the ring is empty */
+struct worker_tag
+{
+  pthread_t thread;
+  ring_t*   pTodo;   // I/O thread -> worker: files read and closed
+  int       iTodoFd; // Bumped after each push to pTodo
+  ring_t*   pDone;   // Worker -> I/O thread: files ciphered
+  int       iWakeFd; // The I/O thread's eventfd, bumped after each push to pDone
+  bool      bEncrypt;
+  bool      isDeck;
+};
+typedef struct worker_tag worker_t;
+
+struct dir_tag
+{
+  char**    pInputs;   // Input path of each file
+  char**    pOutputs;  // Output path of each file
+  size_t    nFiles;
+  size_t    nAlloc;
+  dev_t     iOutputDev; // The output directory, which the walk skips if it lies inside the input
+  ino_t     iOutputIno;
+  uring_t   uring;
+  bool      bUring;    // False if io_uring is unavailable and each operation is run as a blocking syscall
+  bool      bBroken;   // io_uring_enter failed; nothing more can be submitted
+  int       iWakeFd;   // Bumped by workers as they finish files
+  bool      bWakeQueued; // An io_uring read of iWakeFd is in flight
+  uint64_t  iWakeValue;  // Buffer for that read
+  job_t*    pJobs;
+  size_t*   pFree;     // Stack of idle job indices
+  size_t    nFree;
+  uint64_t* pReady;    // Blocking mode: completions (job index << 32 | result) not yet handled
+  size_t    iReadyHead;
+  size_t    iReadyTail;
+  size_t    nFailed;
+};
+typedef struct dir_tag dir_t;
+
+static job_t gStopJob; // Pushed to a worker to end it
+
+static bool walkDirectory(dir_t* pDir, const char* pInput, const char* pOutput);
+static bool uringSetup(uring_t* pUring, unsigned nEntries);
+static void uringFree(uring_t* pUring);
+static void queueOpen(dir_t* pDir, job_t* pJob, const char* pPath, int iFlags, mode_t mode);
+static void queueRead(dir_t* pDir, job_t* pJob);
+static void queueWrite(dir_t* pDir, job_t* pJob);
+static void queueClose(dir_t* pDir, job_t* pJob);
+static void queueWakeRead(dir_t* pDir);
+static bool submitAndReap(dir_t* pDir, bool bWait, uint64_t* pCompletion);
+static bool uringDrain(dir_t* pDir);
+static void signalEvent(int fd);
+static void waitEvent(int fd);
+static bool completeJob(dir_t* pDir, job_t* pJob, int iResult);
+static void finishJob(dir_t* pDir, job_t* pJob, bool bOk);
+static void* dirWorker(void* pArg);
+
+/* Cipher every file under the directory pInput, in the two-line format read by run(), and write each summary
+   to the same relative path under the directory pOutput, which is created if needed. If pOutput is NULL,
+   'output' is used. Opens, reads, writes and closes are queued through io_uring with up to MAX_JOBS files in
+   flight, and the files read are ciphered by nThreads worker threads. If io_uring is unavailable, the same
+   steps run as ordinary blocking syscalls. Idle threads sleep on eventfds rather than polling; the I/O thread
+   keeps a read of its eventfd queued in io_uring so one wait covers both I/O and workers.
+   Returns false if any file could not be processed. */
+bool runDirectory(char* pInput, bool bEncrypt, bool isDeck, unsigned nThreads, char* pOutput)
+{
+  if (nThreads == 0)
+    nThreads = 1;
+  if (pOutput == NULL)
+    pOutput = "output";
+
+  dir_t dir;
+  memset(&dir, 0, sizeof(dir));
+  if (mkdir(pOutput, 0777) != 0 && errno != EEXIST)
+  {
+    fprintf(stderr, "Unable to create output directory '%s': %s.\n", pOutput, strerror(errno));
+    return false;
+  }
+  struct stat outSt;
+  struct stat inSt;
+  if (stat(pOutput, &outSt) != 0)
+  {
+    fprintf(stderr, "Unable to read output directory '%s': %s.\n", pOutput, strerror(errno));
+    return false;
+  }
+  if (stat(pInput, &inSt) == 0 && inSt.st_dev == outSt.st_dev && inSt.st_ino == outSt.st_ino)
+  {
+    fprintf(stderr, "The output directory '%s' cannot be the input directory.\n", pOutput);
+    return false;
+  }
+  dir.iOutputDev = outSt.st_dev;
+  dir.iOutputIno = outSt.st_ino;
+  traceBegin("walk directory");
+  bool bOk = walkDirectory(&dir, pInput, pOutput);
+  traceEnd("walk directory");
+
+  dir.bUring = bOk && uringSetup(&dir.uring, MAX_JOBS);
+  if (bOk && !dir.bUring)
+    fprintf(stderr, "io_uring is unavailable (%s); using blocking I/O.\n", strerror(errno));
+  dir.iWakeFd = eventfd(0, EFD_CLOEXEC);
+  if (bOk && dir.iWakeFd < 0)
+  {
+    fprintf(stderr, "Unable to create an eventfd: %s.\n", strerror(errno));
+    bOk = false;
+  }
+
+  dir.pJobs = malloc(MAX_JOBS * sizeof(job_t));
+  dir.pFree = malloc(MAX_JOBS * sizeof(size_t));
+  dir.pReady = malloc(MAX_JOBS * sizeof(uint64_t));
+  for (size_t i = 0; i < MAX_JOBS; i++)
+    dir.pFree[i] = MAX_JOBS - 1 - i;
+  dir.nFree = MAX_JOBS;
+
+  // Carry on with however many workers could be started
+  worker_t* pWorkers = calloc(nThreads, sizeof(worker_t));
+  unsigned nStarted = 0;
+  for (; bOk && nStarted < nThreads; nStarted++)
+  {
+    pWorkers[nStarted].pTodo = makeRing(MAX_JOBS + 1);
+    pWorkers[nStarted].iTodoFd = eventfd(0, EFD_CLOEXEC);
+    pWorkers[nStarted].pDone = makeRing(MAX_JOBS);
+    pWorkers[nStarted].iWakeFd = dir.iWakeFd;
+    pWorkers[nStarted].bEncrypt = bEncrypt;
+    pWorkers[nStarted].isDeck = isDeck;
+    if (pWorkers[nStarted].iTodoFd < 0 || pthread_create(&pWorkers[nStarted].thread, NULL, dirWorker, &pWorkers[nStarted]) != 0)
+    {
+      if (pWorkers[nStarted].iTodoFd >= 0)
+        close(pWorkers[nStarted].iTodoFd);
+      freeRing(pWorkers[nStarted].pTodo);
+      freeRing(pWorkers[nStarted].pDone);
+      break;
+    }
+  }
+  if (bOk && nStarted < nThreads)
+    fprintf(stderr, "Started %u of %u cipher threads.\n", nStarted, nThreads);
+  nThreads = nStarted;
+  bOk = bOk && nThreads > 0;
+
+  // Keep MAX_JOBS files moving: start new files as jobs free up and advance each file as its I/O completes
+  traceThreadName("io");
+  traceBegin("process files");
+  size_t iNext = 0;
+  size_t nCipher = 0; // Jobs with the workers
+  unsigned iWorker = 0;
+  while (bOk && (iNext < dir.nFiles || dir.nFree < MAX_JOBS))
+  {
+    while (dir.nFree > 0 && iNext < dir.nFiles)
+    {
+      job_t* pJob = &dir.pJobs[dir.pFree[--dir.nFree]];
+      pJob->iFile = iNext++;
+      pJob->pSummary = NULL;
+      pJob->state = JOB_OPEN_IN;
+      queueOpen(&dir, pJob, dir.pInputs[pJob->iFile], O_RDONLY, 0);
+    }
+
+    bool bProgress = false;
+    for (unsigned i = 0; i < nThreads; i++)
+    {
+      job_t* pJob = NULL;
+      while ((pJob = ringPop(pWorkers[i].pDone)) != NULL)
+      {
+        nCipher--;
+        bProgress = true;
+        if (pJob->pSummary == NULL)
+        {
+          fprintf(stderr, "Unable to cipher '%s'.\n", dir.pInputs[pJob->iFile]);
+          finishJob(&dir, pJob, false);
+          continue;
+        }
+        pJob->iSummaryLen = strlen(pJob->pSummary);
+        pJob->iWritten = 0;
+        pJob->state = JOB_OPEN_OUT;
+        queueOpen(&dir, pJob, dir.pOutputs[pJob->iFile], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      }
+    }
+
+    // With nothing to do, sleep until an operation completes or a worker finishes a file. With io_uring,
+    // a read of the wake eventfd is kept queued so that the one wait in the kernel covers both.
+    uint64_t iCompletion = 0;
+    bool bWait = !bProgress;
+    if (bWait && nCipher > 0 && dir.bUring && !dir.bWakeQueued)
+      queueWakeRead(&dir);
+    while (submitAndReap(&dir, bWait, &iCompletion))
+    {
+      bWait = false;
+      bProgress = true;
+      if ((iCompletion >> 32) == WAKE_JOB)
+      {
+        dir.bWakeQueued = false;
+        continue;
+      }
+      job_t* pJob = &dir.pJobs[iCompletion >> 32];
+      if (completeJob(&dir, pJob, (int)(int32_t)(iCompletion & 0xFFFFFFFF)))
+      {
+        pJob->state = JOB_CIPHER;
+        ringPushWait(pWorkers[iWorker].pTodo, pJob);
+        signalEvent(pWorkers[iWorker].iTodoFd);
+        iWorker = (iWorker + 1) % nThreads;
+        nCipher++;
+      }
+    }
+    if (dir.bBroken)
+      bOk = false;
+    else if (bWait && nCipher > 0 && !dir.bUring)
+      waitEvent(dir.iWakeFd); // Blocking I/O has no operations in flight; only a worker can make progress
+  }
+  traceEnd("process files");
+
+  for (unsigned i = 0; i < nThreads; i++)
+  {
+    ringPushWait(pWorkers[i].pTodo, &gStopJob);
+    signalEvent(pWorkers[i].iTodoFd);
+    pthread_join(pWorkers[i].thread, NULL);
+    close(pWorkers[i].iTodoFd);
+    freeRing(pWorkers[i].pTodo);
+    freeRing(pWorkers[i].pDone);
+  }
+  free(pWorkers);
+
+  if (bOk)
+    fprintf(stderr, "Processed %zu files with %s, %zu failed.\n", dir.nFiles, dir.bUring ? "io_uring" : "blocking I/O", dir.nFailed);
+
+  // The kernel may still be reading into jobs or the wake buffer; if it cannot be waited for, leak them
+  bool bDrained = !dir.bUring || uringDrain(&dir);
+  if (dir.bUring)
+    uringFree(&dir.uring);
+  if (dir.iWakeFd >= 0)
+    close(dir.iWakeFd);
+  for (size_t i = 0; i < dir.nFiles; i++)
+  {
+    free(dir.pInputs[i]);
+    free(dir.pOutputs[i]);
+  }
+  free(dir.pInputs);
+  free(dir.pOutputs);
+  if (bDrained)
+    free(dir.pJobs);
+  free(dir.pFree);
+  free(dir.pReady);
+  return bOk && dir.nFailed == 0;
+}
+
+/* Add every regular file under pInput to pDir, creating the matching directories under pOutput.
+   The output directory itself is skipped, so an output tree inside the input is not walked as it grows. */
+static bool walkDirectory(dir_t* pDir, const char* pInput, const char* pOutput)
+{
+  DIR* d = opendir(pInput);
+  if (d == NULL)
+  {
+    fprintf(stderr, "Error opening directory '%s': %s.\n", pInput, strerror(errno));
+    return false;
+  }
+
+  bool bOk = true;
+  struct dirent* pEntry = NULL;
+  while (bOk && (pEntry = readdir(d)) != NULL)
+  {
+    if (strcmp(pEntry->d_name, ".") == 0 || strcmp(pEntry->d_name, "..") == 0)
+      continue;
+
+    size_t iInLen = strlen(pInput) + strlen(pEntry->d_name) + 2;
+    size_t iOutLen = strlen(pOutput) + strlen(pEntry->d_name) + 2;
+    char* pIn = malloc(iInLen);
+    char* pOut = malloc(iOutLen);
+    snprintf(pIn, iInLen, "%s/%s", pInput, pEntry->d_name);
+    snprintf(pOut, iOutLen, "%s/%s", pOutput, pEntry->d_name);
+
+    unsigned char iType = pEntry->d_type;
+    struct stat st;
+    if ((iType == DT_UNKNOWN || iType == DT_DIR) && stat(pIn, &st) == 0)
+    {
+      iType = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+      if (iType == DT_DIR && st.st_dev == pDir->iOutputDev && st.st_ino == pDir->iOutputIno)
+        iType = DT_UNKNOWN;
+    }
+
+    if (iType == DT_DIR)
+    {
+      if (mkdir(pOut, 0777) != 0 && errno != EEXIST)
+      {
+        fprintf(stderr, "Unable to create output directory '%s': %s.\n", pOut, strerror(errno));
+        bOk = false;
+      }
+      else
+        bOk = walkDirectory(pDir, pIn, pOut);
+      free(pIn);
+      free(pOut);
+    }
+    else if (iType == DT_REG)
+    {
+      if (pDir->nFiles == pDir->nAlloc)
+      {
+        pDir->nAlloc = pDir->nAlloc == 0 ? 1024 : pDir->nAlloc * 2;
+        pDir->pInputs = realloc(pDir->pInputs, pDir->nAlloc * sizeof(char*));
+        pDir->pOutputs = realloc(pDir->pOutputs, pDir->nAlloc * sizeof(char*));
+      }
+      pDir->pInputs[pDir->nFiles] = pIn;
+      pDir->pOutputs[pDir->nFiles] = pOut;
+      pDir->nFiles++;
+    }
+    else
+    {
+      free(pIn);
+      free(pOut);
+    }
+  }
+  closedir(d);
+  return bOk;
+}
+
+/* Handle the completed operation of pJob with its result (a file descriptor, a byte count or -errno)
+   and queue the next one. Returns true when the file has been read and is ready for a cipher worker. */
+static bool completeJob(dir_t* pDir, job_t* pJob, int iResult)
+{
+  switch (pJob->state)
+  {
+  case JOB_OPEN_IN:
+    if (iResult < 0)
+    {
+      fprintf(stderr, "Error opening file '%s': %s.\n", pDir->pInputs[pJob->iFile], strerror(-iResult));
+      finishJob(pDir, pJob, false);
+      return false;
+    }
+    pJob->fd = iResult;
+    pJob->state = JOB_READ;
+    queueRead(pDir, pJob);
+    return false;
+  case JOB_READ:
+    pJob->iLen = iResult < 0 ? 0 : (size_t)iResult;
+    if (iResult < 0)
+      fprintf(stderr, "Error reading file '%s': %s.\n", pDir->pInputs[pJob->iFile], strerror(-iResult));
+    pJob->state = JOB_CLOSE_IN;
+    queueClose(pDir, pJob);
+    return false;
+  case JOB_CLOSE_IN:
+    return true;
+  case JOB_OPEN_OUT:
+    if (iResult < 0)
+    {
+      fprintf(stderr, "Unable to create output file '%s': %s\n", pDir->pOutputs[pJob->iFile], strerror(-iResult));
+      finishJob(pDir, pJob, false);
+      return false;
+    }
+    pJob->fd = iResult;
+    pJob->state = JOB_WRITE;
+    queueWrite(pDir, pJob);
+    return false;
+  case JOB_WRITE:
+    if (iResult > 0)
+      pJob->iWritten += (size_t)iResult;
+    if (iResult > 0 && pJob->iWritten < pJob->iSummaryLen)
+    {
+      queueWrite(pDir, pJob);
+      return false;
+    }
+    if (iResult <= 0)
+    {
+      fprintf(stderr, "Error writing output file '%s': %s\n", pDir->pOutputs[pJob->iFile], strerror(iResult < 0 ? -iResult : EIO));
+      pJob->iSummaryLen = 0; // Marks the file as failed once closed
+    }
+    pJob->state = JOB_CLOSE_OUT;
+    queueClose(pDir, pJob);
+    return false;
+  case JOB_CLOSE_OUT:
+    if (iResult < 0)
+      fprintf(stderr, "Error closing output file '%s': %s\n", pDir->pOutputs[pJob->iFile], strerror(-iResult));
+    finishJob(pDir, pJob, iResult >= 0 && pJob->iWritten == pJob->iSummaryLen && pJob->iSummaryLen > 0);
+    return false;
+  case JOB_CIPHER:
+    break;
+  }
+  return false;
+}
+
+/* Release pJob for the next file */
+static void finishJob(dir_t* pDir, job_t* pJob, bool bOk)
+{
+  if (!bOk)
+    pDir->nFailed++;
+  free(pJob->pSummary);
+  pJob->pSummary = NULL;
+  pDir->pFree[pDir->nFree++] = (size_t)(pJob - pDir->pJobs);
+}
+
+/* Worker thread: cipher files as the I/O thread reads them */
+static void* dirWorker(void* pArg)
+{
+  worker_t* pWorker = pArg;
+  traceThreadName("cipher");
+  while (true)
+  {
+    job_t* pJob = ringPop(pWorker->pTodo);
+    if (pJob == NULL)
+    {
+      waitEvent(pWorker->iTodoFd);
+      continue;
+    }
+    if (pJob == &gStopJob)
+      break;
+
+    // Split the first two lines exactly as parseFile() does with fgets(): each piece holds at most
+    // LINE_LIMIT chars, counting its line break, which is then dropped
+    char pLines[2][LINE_LIMIT + 1] = { { 0 }, { 0 } };
+    size_t iPos = 0;
+    for (size_t iLine = 0; iLine < 2 && iPos < pJob->iLen; iLine++)
+    {
+      size_t iEnd = iPos;
+      while (iEnd < pJob->iLen && iEnd - iPos < LINE_LIMIT && pJob->pBuffer[iEnd] != '\n')
+        iEnd++;
+      memcpy(pLines[iLine], pJob->pBuffer + iPos, iEnd - iPos);
+      pLines[iLine][iEnd - iPos] = '\0';
+      iPos = iEnd < pJob->iLen && iEnd - iPos < LINE_LIMIT ? iEnd + 1 : iEnd;
+    }
+
+    if (pLines[0][0] == '\0')
+      fprintf(stderr, "Input cipher text was blank\n");
+    else
+      pJob->pSummary = cipherSummary(pLines[0], pLines[1][0] != '\0' ? pLines[1] : NULL, pWorker->bEncrypt, pWorker->isDeck);
+    ringPushWait(pWorker->pDone, pJob);
+    signalEvent(pWorker->iWakeFd);
+  }
+  return NULL;
+}
+
+/* Add one to the eventfd fd, waking a thread sleeping in waitEvent() or an io_uring read of it */
+static void signalEvent(int fd)
+{
+  uint64_t iOne = 1;
+  while (write(fd, &iOne, sizeof(iOne)) < 0 && errno == EINTR)
+    ;
+}
+
+/* Sleep until the eventfd fd has been signalled since it was last waited on */
+static void waitEvent(int fd)
+{
+  uint64_t iCount = 0;
+  if (read(fd, &iCount, sizeof(iCount)) < 0 && errno != EINTR)
+    sched_yield(); // Should not happen; degrade to polling rather than spin flat out
+}
+
+static void queueOpen(dir_t* pDir, job_t* pJob, const char* pPath, int iFlags, mode_t mode)
+{
+  if (!pDir->bUring)
+  {
+    int iResult = open(pPath, iFlags, mode);
+    pDir->pReady[pDir->iReadyTail++ % MAX_JOBS] = ((uint64_t)(pJob - pDir->pJobs) << 32) | (uint32_t)(iResult < 0 ? -errno : iResult);
+    return;
+  }
+
+  uring_t* pUring = &pDir->uring;
+  unsigned iIndex = (*pUring->sqTail + pUring->nQueued) & *pUring->sqMask;
+  struct io_uring_sqe* pSqe = &pUring->sqes[iIndex];
+  memset(pSqe, 0, sizeof(*pSqe));
+  pSqe->opcode = IORING_OP_OPENAT;
+  pSqe->fd = AT_FDCWD;
+  pSqe->addr = (uint64_t)(uintptr_t)pPath;
+  pSqe->len = mode;
+  pSqe->open_flags = (uint32_t)(iFlags | O_CLOEXEC);
+  pSqe->user_data = (uint64_t)(pJob - pDir->pJobs);
+  pUring->sqArray[iIndex] = iIndex;
+  pUring->nQueued++;
+}
+
+static void queueRead(dir_t* pDir, job_t* pJob)
+{
+  if (!pDir->bUring)
+  {
+    ssize_t iResult = read(pJob->fd, pJob->pBuffer, JOB_BUFFER);
+    pDir->pReady[pDir->iReadyTail++ % MAX_JOBS] = ((uint64_t)(pJob - pDir->pJobs) << 32) | (uint32_t)(iResult < 0 ? -errno : (int)iResult);
+    return;
+  }
+
+  uring_t* pUring = &pDir->uring;
+  unsigned iIndex = (*pUring->sqTail + pUring->nQueued) & *pUring->sqMask;
+  struct io_uring_sqe* pSqe = &pUring->sqes[iIndex];
+  memset(pSqe, 0, sizeof(*pSqe));
+  pSqe->opcode = IORING_OP_READ;
+  pSqe->fd = pJob->fd;
+  pSqe->addr = (uint64_t)(uintptr_t)pJob->pBuffer;
+  pSqe->len = JOB_BUFFER;
+  pSqe->off = 0;
+  pSqe->user_data = (uint64_t)(pJob - pDir->pJobs);
+  pUring->sqArray[iIndex] = iIndex;
+  pUring->nQueued++;
+}
+
+static void queueWrite(dir_t* pDir, job_t* pJob)
+{
+  if (!pDir->bUring)
+  {
+    ssize_t iResult = write(pJob->fd, pJob->pSummary + pJob->iWritten, pJob->iSummaryLen - pJob->iWritten);
+    pDir->pReady[pDir->iReadyTail++ % MAX_JOBS] = ((uint64_t)(pJob - pDir->pJobs) << 32) | (uint32_t)(iResult < 0 ? -errno : (int)iResult);
+    return;
+  }
+
+  uring_t* pUring = &pDir->uring;
+  unsigned iIndex = (*pUring->sqTail + pUring->nQueued) & *pUring->sqMask;
+  struct io_uring_sqe* pSqe = &pUring->sqes[iIndex];
+  memset(pSqe, 0, sizeof(*pSqe));
+  pSqe->opcode = IORING_OP_WRITE;
+  pSqe->fd = pJob->fd;
+  pSqe->addr = (uint64_t)(uintptr_t)(pJob->pSummary + pJob->iWritten);
+  pSqe->len = (uint32_t)(pJob->iSummaryLen - pJob->iWritten);
+  pSqe->off = pJob->iWritten;
+  pSqe->user_data = (uint64_t)(pJob - pDir->pJobs);
+  pUring->sqArray[iIndex] = iIndex;
+  pUring->nQueued++;
+}
+
+static void queueClose(dir_t* pDir, job_t* pJob)
+{
+  if (!pDir->bUring)
+  {
+    int iResult = close(pJob->fd);
+    pDir->pReady[pDir->iReadyTail++ % MAX_JOBS] = ((uint64_t)(pJob - pDir->pJobs) << 32) | (uint32_t)(iResult < 0 ? -errno : 0);
+    return;
+  }
+
+  uring_t* pUring = &pDir->uring;
+  unsigned iIndex = (*pUring->sqTail + pUring->nQueued) & *pUring->sqMask;
+  struct io_uring_sqe* pSqe = &pUring->sqes[iIndex];
+  memset(pSqe, 0, sizeof(*pSqe));
+  pSqe->opcode = IORING_OP_CLOSE;
+  pSqe->fd = pJob->fd;
+  pSqe->user_data = (uint64_t)(pJob - pDir->pJobs);
+  pUring->sqArray[iIndex] = iIndex;
+  pUring->nQueued++;
+}
+
+/* Queue a read of the wake eventfd; it completes, as job WAKE_JOB, once a worker has finished a file */
+static void queueWakeRead(dir_t* pDir)
+{
+  uring_t* pUring = &pDir->uring;
+  unsigned iIndex = (*pUring->sqTail + pUring->nQueued) & *pUring->sqMask;
+  struct io_uring_sqe* pSqe = &pUring->sqes[iIndex];
+  memset(pSqe, 0, sizeof(*pSqe));
+  pSqe->opcode = IORING_OP_READ;
+  pSqe->fd = pDir->iWakeFd;
+  pSqe->addr = (uint64_t)(uintptr_t)&pDir->iWakeValue;
+  pSqe->len = sizeof(pDir->iWakeValue);
+  pSqe->user_data = WAKE_JOB;
+  pUring->sqArray[iIndex] = iIndex;
+  pUring->nQueued++;
+  pDir->bWakeQueued = true;
+}
+
+/* Pass any queued operations to the kernel and take one completion, as (job index << 32 | result), into
+   pCompletion. If bWait is set, sleep until a completion arrives. Returns false if there was none.
+   If io_uring_enter fails, bBroken is set and nothing more is submitted. */
+static bool submitAndReap(dir_t* pDir, bool bWait, uint64_t* pCompletion)
+{
+  if (!pDir->bUring)
+  {
+    if (pDir->iReadyHead == pDir->iReadyTail)
+      return false;
+    *pCompletion = pDir->pReady[pDir->iReadyHead++ % MAX_JOBS];
+    return true;
+  }
+
+  uring_t* pUring = &pDir->uring;
+  unsigned iHead = *pUring->cqHead;
+  bool bEmpty = iHead == __atomic_load_n(pUring->cqTail, __ATOMIC_ACQUIRE);
+  if (!pDir->bBroken && (pUring->nQueued > 0 || (bEmpty && bWait)))
+  {
+    // Entries the kernel did not take last time are still between head and tail
+    unsigned iTail = *pUring->sqTail + pUring->nQueued;
+    __atomic_store_n(pUring->sqTail, iTail, __ATOMIC_RELEASE);
+    unsigned nSubmit = iTail - __atomic_load_n(pUring->sqHead, __ATOMIC_ACQUIRE);
+    pUring->nQueued = 0;
+    traceBegin("io_uring_enter");
+    long iResult = syscall(__NR_io_uring_enter, pUring->fd, nSubmit, bEmpty && bWait ? 1 : 0,
+                           bEmpty && bWait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    traceEnd("io_uring_enter");
+    if (iResult < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+    {
+      fprintf(stderr, "io_uring_enter failed: %s.\n", strerror(errno));
+      pDir->bBroken = true;
+    }
+  }
+
+  if (iHead == __atomic_load_n(pUring->cqTail, __ATOMIC_ACQUIRE))
+    return false;
+  struct io_uring_cqe* pCqe = &pUring->cqes[iHead & *pUring->cqMask];
+  *pCompletion = (pCqe->user_data << 32) | (uint32_t)pCqe->res;
+  __atomic_store_n(pUring->cqHead, iHead + 1, __ATOMIC_RELEASE);
+  pUring->nReaped++;
+  return true;
+}
+
+/* Wait for every operation the kernel has taken to complete, so none writes into freed memory.
+   Returns false if they could not be waited for. */
+static bool uringDrain(dir_t* pDir)
+{
+  uring_t* pUring = &pDir->uring;
+  if (pDir->bWakeQueued)
+    signalEvent(pDir->iWakeFd); // No worker is left to complete the wake read
+
+  while (__atomic_load_n(pUring->sqHead, __ATOMIC_ACQUIRE) != pUring->nReaped)
+  {
+    unsigned iHead = *pUring->cqHead;
+    if (iHead == __atomic_load_n(pUring->cqTail, __ATOMIC_ACQUIRE))
+    {
+      if (syscall(__NR_io_uring_enter, pUring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+      {
+        fprintf(stderr, "Unable to wait for outstanding io_uring operations: %s.\n", strerror(errno));
+        return false;
+      }
+      continue;
+    }
+    __atomic_store_n(pUring->cqHead, iHead + 1, __ATOMIC_RELEASE);
+    pUring->nReaped++;
+  }
+  return true;
+}
+
+/* Create an io_uring with room for nEntries submissions and map its rings. Returns false, with errno set,
+   if the kernel does not support io_uring or it is not permitted. */
+static bool uringSetup(uring_t* pUring, unsigned nEntries)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(pUring, 0, sizeof(*pUring));
+  pUring->fd = (int)syscall(__NR_io_uring_setup, nEntries, &params);
+  if (pUring->fd < 0)
+    return false;
+
+  pUring->iSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  pUring->iCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    if (pUring->iCqRingSize > pUring->iSqRingSize)
+      pUring->iSqRingSize = pUring->iCqRingSize;
+    pUring->iCqRingSize = pUring->iSqRingSize;
+  }
+  pUring->pSqRing = mmap(NULL, pUring->iSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pUring->fd, IORING_OFF_SQ_RING);
+  if (pUring->pSqRing == MAP_FAILED)
+  {
+    int iError = errno;
+    close(pUring->fd);
+    errno = iError;
+    return false;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    pUring->pCqRing = pUring->pSqRing;
+  else
+    pUring->pCqRing = mmap(NULL, pUring->iCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pUring->fd, IORING_OFF_CQ_RING);
+  pUring->iSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  pUring->sqes = mmap(NULL, pUring->iSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pUring->fd, IORING_OFF_SQES);
+  if (pUring->pCqRing == MAP_FAILED || pUring->sqes == MAP_FAILED)
+  {
+    int iError = errno;
+    if (pUring->sqes != MAP_FAILED)
+      munmap(pUring->sqes, pUring->iSqesSize);
+    if (pUring->pCqRing != MAP_FAILED && pUring->pCqRing != pUring->pSqRing)
+      munmap(pUring->pCqRing, pUring->iCqRingSize);
+    munmap(pUring->pSqRing, pUring->iSqRingSize);
+    close(pUring->fd);
+    errno = iError;
+    return false;
+  }
+
+  char* pSq = pUring->pSqRing;
+  char* pCq = pUring->pCqRing;
+  pUring->sqHead = (unsigned*)(pSq + params.sq_off.head);
+  pUring->sqTail = (unsigned*)(pSq + params.sq_off.tail);
+  pUring->sqMask = (unsigned*)(pSq + params.sq_off.ring_mask);
+  pUring->sqArray = (unsigned*)(pSq + params.sq_off.array);
+  pUring->cqHead = (unsigned*)(pCq + params.cq_off.head);
+  pUring->cqTail = (unsigned*)(pCq + params.cq_off.tail);
+  pUring->cqMask = (unsigned*)(pCq + params.cq_off.ring_mask);
+  pUring->cqes = (struct io_uring_cqe*)(pCq + params.cq_off.cqes);
+  return true;
+}
+
+static void uringFree(uring_t* pUring)
+{
+  munmap(pUring->sqes, pUring->iSqesSize);
+  if (pUring->pCqRing != pUring->pSqRing)
+    munmap(pUring->pCqRing, pUring->iCqRingSize);
+  munmap(pUring->pSqRing, pUring->iSqRingSize);
+  close(pUring->fd);
+}
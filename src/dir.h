@@ -0,0 +1,6 @@
+#ifndef DIR_H
+#define DIR_H
+#include <stdbool.h>
+
+bool runDirectory(char* pInput, bool bEncrypt, bool isDeck, unsigned nThreads, char* pOutput);
+#endif
@@ -0,0 +1,377 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ENGINE_X86
+#endif
+
+#include "engine.h"
+
+/* Keystream engines. The scalar engine is packedKeystreamBlock(). The SSE4 and AVX2 engines run the same
+   steps on a padded copy of the deck, finding the Jokers with vector compares and doing the cuts as
+   fixed-width vector copies, which may run past the 54 cards into the padding. The AVX-512 engine keeps
+   the whole deck in one register and does every step as a single byte permutation (VBMI vpermb).
+   Engines are compiled for their instruction set with target attributes, so the rest of the build
+   stays portable and only runs them on CPUs that support them. */
+
+#define WORK_SIZE 192          // 54 cards plus room for 64-byte copies that start anywhere in the deck
+#define CARD_MASK ((1ULL << DECK_SIZE) - 1)
+#define BENCH_VALUES 20000     // Keystream values per engine in the self-benchmark
+#define BENCH_ROUNDS 3
+
+static bool scalarSupported(void);
+#ifdef ENGINE_X86
+static bool sse4Supported(void);
+static bool avx2Supported(void);
+static bool avx512Supported(void);
+static void sse4Keystream(packed_t* pPacked, unsigned char* pOut, size_t iLen);
+static void avx2Keystream(packed_t* pPacked, unsigned char* pOut, size_t iLen);
+static void avx512Keystream(packed_t* pPacked, unsigned char* pOut, size_t iLen);
+#endif
+static double engineNow();
+
+/* Least to most capable; without a benchmark, the last engine this CPU supports is the default */
+static const engine_t ENGINES[] =
+{
+  { "scalar", scalarSupported, packedKeystreamBlock },
+#ifdef ENGINE_X86
+  { "sse4",   sse4Supported,   sse4Keystream },
+  { "avx2",   avx2Supported,   avx2Keystream },
+  { "avx512", avx512Supported, avx512Keystream },
+#endif
+};
+#define NUM_ENGINES (sizeof(ENGINES) / sizeof(ENGINES[0]))
+
+static _Atomic(const engine_t*) gCurrent = NULL;
+
+/* Return every engine compiled in, supported by this CPU or not */
+const engine_t* engineList(size_t* pCount)
+{
+  *pCount = NUM_ENGINES;
+  return ENGINES;
+}
+
+/* Choose the engine used by engineKeystream(). With pName, that engine is used if this CPU supports it.
+   Otherwise bBenchmark times every supported engine and picks the fastest, or else the most preferred
+   supported engine is used. Returns the engine chosen, or NULL if pName is unknown or unsupported. */
+const engine_t* engineSelect(const char* pName, bool bBenchmark)
+{
+  const engine_t* pChosen = NULL;
+  if (pName != NULL)
+  {
+    for (size_t i = 0; i < NUM_ENGINES; i++)
+    {
+      if (strcmp(ENGINES[i].pName, pName) == 0)
+        pChosen = &ENGINES[i];
+    }
+    if (pChosen == NULL)
+    {
+      fprintf(stderr, "Unknown engine '%s'.\n", pName);
+      return NULL;
+    }
+    if (!pChosen->supported())
+    {
+      fprintf(stderr, "Engine '%s' is not supported by this CPU.\n", pName);
+      return NULL;
+    }
+  }
+  else if (bBenchmark)
+  {
+    unsigned char* pOut = malloc(BENCH_VALUES);
+    double dBest = 0.0;
+    for (size_t i = 0; i < NUM_ENGINES; i++)
+    {
+      if (!ENGINES[i].supported())
+        continue;
+      double dFastest = 0.0;
+      for (unsigned r = 0; r < BENCH_ROUNDS; r++)
+      {
+        packed_t packed;
+        standardPacked(&packed);
+        double dStart = engineNow();
+        ENGINES[i].keystream(&packed, pOut, BENCH_VALUES);
+        double dSeconds = engineNow() - dStart;
+        if (r == 0 || dSeconds < dFastest)
+          dFastest = dSeconds;
+      }
+      fprintf(stderr, "Engine %-7s %7.1f ns per value\n", ENGINES[i].pName, dFastest * 1e9 / BENCH_VALUES);
+      if (pChosen == NULL || dFastest < dBest)
+      {
+        pChosen = &ENGINES[i];
+        dBest = dFastest;
+      }
+    }
+    free(pOut);
+    fprintf(stderr, "Using engine %s\n", pChosen->pName);
+  }
+  else
+  {
+    for (size_t i = 0; i < NUM_ENGINES; i++)
+    {
+      if (ENGINES[i].supported())
+        pChosen = &ENGINES[i];
+    }
+  }
+
+  atomic_store(&gCurrent, pChosen);
+  return pChosen;
+}
+
+/* Return the engine in use, choosing the default on first use */
+const engine_t* engineCurrent()
+{
+  const engine_t* pEngine = atomic_load_explicit(&gCurrent, memory_order_acquire);
+  if (pEngine == NULL)
+    pEngine = engineSelect(NULL, false);
+  return pEngine;
+}
+
+/* Fill pOut with the next iLen keystream values (1-26) using the current engine */
+void engineKeystream(packed_t* pPacked, unsigned char* pOut, size_t iLen)
+{
+  engineCurrent()->keystream(pPacked, pOut, iLen);
+}
+
+static bool scalarSupported(void)
+{
+  return true;
+}
+
+static double engineNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+#ifdef ENGINE_X86
+
+static bool sse4Supported(void)
+{
+  return __builtin_cpu_supports("sse4.1");
+}
+
+static bool avx2Supported(void)
+{
+  return __builtin_cpu_supports("avx2");
+}
+
+static bool avx512Supported(void)
+{
+  return __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vbmi");
+}
+
+/* Bit i is set where pCards[i] == iCard, for the 64 bytes at pCards */
+typedef uint64_t (*findFn_t)(const unsigned char* pCards, unsigned char iCard);
+
+/* Copy 64 bytes. pDst may overlap pSrc from pSrc + 53 upwards, since only the first 53 bytes must survive. */
+typedef void (*copyFn_t)(unsigned char* pDst, const unsigned char* pSrc);
+
+/* Move a Joker down iShift places, wrapping around to just below the top card */
+static inline __attribute__((always_inline))
+void workMoveJoker(unsigned char* pDeck, unsigned char iJoker, size_t iShift, findFn_t find)
+{
+  size_t iFrom = (size_t)__builtin_ctzll(find(pDeck, iJoker) & CARD_MASK);
+  size_t iTo = iFrom + iShift;
+  if (iTo >= DECK_SIZE)
+    iTo -= DECK_SIZE - 1;
+
+  if (iTo > iFrom)
+  {
+    for (size_t i = iFrom; i < iTo; i++)
+      pDeck[i] = pDeck[i + 1];
+  }
+  else
+    memmove(pDeck + iTo + 1, pDeck + iTo, iFrom - iTo);
+  pDeck[iTo] = iJoker;
+}
+
+/* One deck step on the padded deck pDeck, using pTemp as scratch */
+static inline __attribute__((always_inline))
+void workStep(unsigned char* pDeck, unsigned char* pTemp, findFn_t find, copyFn_t copy)
+{
+  workMoveJoker(pDeck, JOKER_A, 1, find);
+  workMoveJoker(pDeck, JOKER_B, 2, find);
+
+  // Triple cut: each copy's overrun is overwritten by the next segment
+  size_t iA = (size_t)__builtin_ctzll(find(pDeck, JOKER_A) & CARD_MASK);
+  size_t iB = (size_t)__builtin_ctzll(find(pDeck, JOKER_B) & CARD_MASK);
+  size_t iFirst = iA < iB ? iA : iB;
+  size_t iSecond = iA ^ iB ^ iFirst;
+  size_t iBottom = DECK_SIZE - 1 - iSecond;
+  copy(pTemp, pDeck + iSecond + 1);
+  copy(pTemp + iBottom, pDeck + iFirst);
+  copy(pTemp + iBottom + iSecond - iFirst + 1, pDeck);
+
+  // Count cut: rotate the top 53 cards out of a doubled copy, then put the bottom card back
+  unsigned char iLast = pTemp[DECK_SIZE - 1];
+  copy(pTemp + DECK_SIZE - 1, pTemp);
+  copy(pDeck, pTemp + CUT_VALUE[iLast]);
+  pDeck[DECK_SIZE - 1] = iLast;
+}
+
+/* The keystream loop shared by the copy-based engines */
+static inline __attribute__((always_inline))
+void workKeystream(packed_t* pPacked, unsigned char* pOut, size_t iLen, findFn_t find, copyFn_t copy)
+{
+  _Alignas(64) unsigned char pDeck[WORK_SIZE] = { 0 };
+  _Alignas(64) unsigned char pTemp[WORK_SIZE] = { 0 };
+  memcpy(pDeck, pPacked->cards, DECK_SIZE);
+
+  for (size_t i = 0; i < iLen; i++)
+  {
+    unsigned iOut = 0;
+    do
+    {
+      workStep(pDeck, pTemp, find, copy);
+      iOut = OUT_VALUE[pDeck[CUT_VALUE[pDeck[0]]]];
+    }
+    while (iOut == 0);
+    pOut[i] = (unsigned char)iOut;
+  }
+  memcpy(pPacked->cards, pDeck, DECK_SIZE);
+}
+
+__attribute__((target("sse4.1")))
+static uint64_t sse4Find(const unsigned char* pCards, unsigned char iCard)
+{
+  __m128i key = _mm_set1_epi8((char)iCard);
+  uint64_t iMask = 0;
+  for (unsigned i = 0; i < 4; i++)
+  {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(pCards + 16 * i));
+    iMask |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, key)) << (16 * i);
+  }
+  return iMask;
+}
+
+__attribute__((target("sse4.1")))
+static void sse4Copy(unsigned char* pDst, const unsigned char* pSrc)
+{
+  for (unsigned i = 0; i < 4; i++)
+    _mm_storeu_si128((__m128i*)(pDst + 16 * i), _mm_loadu_si128((const __m128i*)(pSrc + 16 * i)));
+}
+
+__attribute__((target("sse4.1")))
+static void sse4Keystream(packed_t* pPacked, unsigned char* pOut, size_t iLen)
+{
+  workKeystream(pPacked, pOut, iLen, sse4Find, sse4Copy);
+}
+
+__attribute__((target("avx2")))
+static uint64_t avx2Find(const unsigned char* pCards, unsigned char iCard)
+{
+  __m256i key = _mm256_set1_epi8((char)iCard);
+  __m256i low = _mm256_loadu_si256((const __m256i*)pCards);
+  __m256i high = _mm256_loadu_si256((const __m256i*)(pCards + 32));
+  return (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, key)) |
+         (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, key)) << 32;
+}
+
+__attribute__((target("avx2")))
+static void avx2Copy(unsigned char* pDst, const unsigned char* pSrc)
+{
+  __m256i low = _mm256_loadu_si256((const __m256i*)pSrc);
+  __m256i high = _mm256_loadu_si256((const __m256i*)(pSrc + 32));
+  _mm256_storeu_si256((__m256i*)pDst, low);
+  _mm256_storeu_si256((__m256i*)(pDst + 32), high);
+}
+
+__attribute__((target("avx2")))
+static void avx2Keystream(packed_t* pPacked, unsigned char* pOut, size_t iLen)
+{
+  workKeystream(pPacked, pOut, iLen, avx2Find, avx2Copy);
+}
+
+#define AVX512_TARGET "avx512f,avx512bw,avx512vbmi"
+
+/* Card iPos of the deck in a register */
+__attribute__((target(AVX512_TARGET)))
+static inline unsigned avx512Card(__m512i deck, unsigned iPos)
+{
+  return (unsigned)_mm512_cvtsi512_si32(_mm512_permutexvar_epi8(_mm512_set1_epi8((char)iPos), deck)) & 0xff;
+}
+
+/* Position of iCard in the deck in a register */
+__attribute__((target(AVX512_TARGET)))
+static inline unsigned avx512Find(__m512i deck, unsigned char iCard)
+{
+  return (unsigned)__builtin_ctzll(_mm512_cmpeq_epi8_mask(deck, _mm512_set1_epi8((char)iCard)) & CARD_MASK);
+}
+
+/* Lanes lo to hi-1 (hi at most 63) */
+static inline uint64_t laneRange(unsigned lo, unsigned hi)
+{
+  return ((1ULL << hi) - 1) & ~((1ULL << lo) - 1);
+}
+
+__attribute__((target(AVX512_TARGET)))
+static inline __m512i avx512MoveJoker(__m512i deck, __m512i iota, unsigned char iJoker, unsigned iShift)
+{
+  unsigned iFrom = avx512Find(deck, iJoker);
+  unsigned iTo = iFrom + iShift;
+  if (iTo >= DECK_SIZE)
+    iTo -= DECK_SIZE - 1;
+
+  // Cards between the two positions shift by one towards iFrom, and lane iTo takes the Joker
+  __m512i one = _mm512_set1_epi8(1);
+  __m512i index = (iTo > iFrom) ? _mm512_mask_add_epi8(iota, laneRange(iFrom, iTo), iota, one)
+                                : _mm512_mask_sub_epi8(iota, laneRange(iTo + 1, iFrom + 1), iota, one);
+  index = _mm512_mask_mov_epi8(index, 1ULL << iTo, _mm512_set1_epi8((char)iFrom));
+  return _mm512_permutexvar_epi8(index, deck);
+}
+
+__attribute__((target(AVX512_TARGET)))
+static void avx512Keystream(packed_t* pPacked, unsigned char* pOut, size_t iLen)
+{
+  static const unsigned char IOTA[64] =
+  {
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
+    16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+    32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+    48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63
+  };
+  __m512i iota = _mm512_loadu_si512(IOTA);
+  __m512i deck = _mm512_maskz_loadu_epi8(CARD_MASK, pPacked->cards);
+
+  for (size_t i = 0; i < iLen; i++)
+  {
+    unsigned iOut = 0;
+    do
+    {
+      deck = avx512MoveJoker(deck, iota, JOKER_A, 1);
+      deck = avx512MoveJoker(deck, iota, JOKER_B, 2);
+
+      // Triple cut: lanes below iBottom take the cards under the second Joker, then the middle, then the top
+      unsigned iA = avx512Find(deck, JOKER_A);
+      unsigned iB = avx512Find(deck, JOKER_B);
+      unsigned iFirst = iA < iB ? iA : iB;
+      unsigned iSecond = iA ^ iB ^ iFirst;
+      unsigned iBottom = DECK_SIZE - 1 - iSecond;
+      unsigned iTop = DECK_SIZE - iFirst;
+      unsigned iLast = iFirst > 0 ? avx512Card(deck, iFirst - 1) : JOKER_B;
+      __m512i index = _mm512_add_epi8(iota, _mm512_set1_epi8((char)(iSecond + 1)));
+      index = _mm512_mask_add_epi8(index, ~laneRange(0, iBottom), iota, _mm512_set1_epi8((char)(iFirst - iBottom)));
+      index = _mm512_mask_sub_epi8(index, ~laneRange(0, iTop), iota, _mm512_set1_epi8((char)iTop));
+      deck = _mm512_permutexvar_epi8(index, deck);
+
+      // Count cut: rotate the top 53 lanes by the bottom card's value
+      unsigned iValue = CUT_VALUE[iLast];
+      index = _mm512_add_epi8(iota, _mm512_set1_epi8((char)iValue));
+      index = _mm512_mask_sub_epi8(index, laneRange(DECK_SIZE - 1 - iValue, DECK_SIZE - 1), index,
+                                   _mm512_set1_epi8(DECK_SIZE - 1));
+      index = _mm512_mask_mov_epi8(index, 1ULL << (DECK_SIZE - 1), _mm512_set1_epi8(DECK_SIZE - 1));
+      deck = _mm512_permutexvar_epi8(index, deck);
+
+      iOut = OUT_VALUE[avx512Card(deck, CUT_VALUE[avx512Card(deck, 0)])];
+    }
+    while (iOut == 0);
+    pOut[i] = (unsigned char)iOut;
+  }
+  _mm512_mask_storeu_epi8(pPacked->cards, CARD_MASK, deck);
+}
+#endif
@@ -0,0 +1,21 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+#include <stdbool.h>
+#include <stdlib.h>
+#include "packed.h"
+
+/* A keystream engine: a deck/keystream core built for one instruction set.
+   Every engine produces exactly the same values as packedKeystreamBlock(). */
+struct engine_tag
+{
+  const char* pName;
+  bool (*supported)(void); // True if this CPU can run the engine
+  void (*keystream)(packed_t* pPacked, unsigned char* pOut, size_t iLen);
+};
+typedef struct engine_tag engine_t;
+
+const engine_t* engineList(size_t* pCount);
+const engine_t* engineSelect(const char* pName, bool bBenchmark);
+const engine_t* engineCurrent();
+void engineKeystream(packed_t* pPacked, unsigned char* pOut, size_t iLen);
+#endif
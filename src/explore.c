@@ -0,0 +1,370 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mini.h"
+
+/* Exhaustive analysis of the state graph of an n-card deck.
+
+   Every ordering of the deck is one state, numbered by its rank in lexicographic order (its Lehmer
+   code), so the states of n cards are exactly 0 to n!-1. One deck step maps each state to a successor.
+   Worker threads step every state to fill a successor array of 32-bit ranks, which fits up to 12 cards.
+   Larger decks compute successors again whenever they are needed. Per-state facts are kept in bitmaps:
+   two bits of saturating in-degree, a visited bit and an on-path bit, so 13 cards need about 3 GiB. */
+
+#define EXPLORE_MAX 13
+#define STORED_MAX 12 // 12! still fits a 32-bit rank
+#define PROGRESS_STEP (1ULL << 26)
+
+struct explorer_tag
+{
+  unsigned          n;
+  uint64_t          nStates;
+  uint32_t*         pSuccessors; // NULL when successors are computed on demand
+  _Atomic uint64_t* pOnce;       // In-degree is at least 1
+  _Atomic uint64_t* pTwice;      // In-degree is at least 2
+  uint64_t          pFactorials[EXPLORE_MAX + 1];
+};
+typedef struct explorer_tag explorer_t;
+
+struct stepTask_tag
+{
+  explorer_t* pExplorer;
+  uint64_t    iFirst;
+  uint64_t    iLast;
+  uint64_t    pFirstOutput[MINI_MAX]; // First keystream value of every state; index 0 counts Joker outputs
+  bool        bThread;                // False if the range's thread could not be started
+};
+typedef struct stepTask_tag stepTask_t;
+
+void usage();
+uint64_t rankCards(explorer_t* pExplorer, const unsigned char* pCards);
+void unrankCards(explorer_t* pExplorer, uint64_t iRank, unsigned char* pCards);
+void nextCards(unsigned char* pCards, unsigned n);
+uint64_t successor(explorer_t* pExplorer, uint64_t iRank);
+void* stepStates(void* pArg);
+int compareLengths(const void* pA, const void* pB);
+void printHistogram(const char* pTitle, uint64_t* pCounts, unsigned nValues, uint64_t nTotal);
+double elapsed(struct timespec* pStart);
+
+static inline bool testBit(_Atomic uint64_t* pBits, uint64_t i)
+{
+  return (atomic_load_explicit(&pBits[i / 64], memory_order_relaxed) >> (i % 64)) & 1;
+}
+
+static inline void setBit(_Atomic uint64_t* pBits, uint64_t i)
+{
+  atomic_fetch_or_explicit(&pBits[i / 64], 1ULL << (i % 64), memory_order_relaxed);
+}
+
+static inline void clearBit(_Atomic uint64_t* pBits, uint64_t i)
+{
+  atomic_fetch_and_explicit(&pBits[i / 64], ~(1ULL << (i % 64)), memory_order_relaxed);
+}
+
+/* Usage: solitaire-explore [-n cards] [-j threads] */
+int main(int argc, char **argv)
+{
+  unsigned n = 9;
+  unsigned nThreads = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  int c = -1;
+  while ((c = getopt(argc, argv, "j:n:")) != -1)
+  {
+    switch (c)
+    {
+    case 'j':
+      nThreads = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      n = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind != argc || n < 3 || n > EXPLORE_MAX)
+  {
+    usage();
+    return EXIT_FAILURE;
+  }
+  if (nThreads == 0)
+    nThreads = 1;
+
+  explorer_t explorer;
+  memset(&explorer, 0, sizeof(explorer));
+  explorer.n = n;
+  explorer.pFactorials[0] = 1;
+  for (unsigned i = 1; i <= n; i++)
+    explorer.pFactorials[i] = explorer.pFactorials[i - 1] * i;
+  explorer.nStates = explorer.pFactorials[n];
+
+  size_t nWords = (size_t)((explorer.nStates + 63) / 64);
+  explorer.pOnce = calloc(nWords, sizeof(uint64_t));
+  explorer.pTwice = calloc(nWords, sizeof(uint64_t));
+  _Atomic uint64_t* pVisited = calloc(nWords, sizeof(uint64_t));
+  _Atomic uint64_t* pOnPath = calloc(nWords, sizeof(uint64_t));
+  if (explorer.pOnce == NULL || explorer.pTwice == NULL || pVisited == NULL || pOnPath == NULL)
+  {
+    fprintf(stderr, "Unable to allocate the state bitmaps for %u cards.\n", n);
+    return EXIT_FAILURE;
+  }
+  if (n <= STORED_MAX)
+    explorer.pSuccessors = malloc(explorer.nStates * sizeof(uint32_t));
+
+  printf("%u cards: %llu states, successors %s\n", n, (unsigned long long)explorer.nStates,
+         explorer.pSuccessors != NULL ? "stored" : "computed on demand");
+
+  // Step every state in parallel, counting in-degrees and the first keystream value
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  stepTask_t* pTasks = calloc(nThreads, sizeof(stepTask_t));
+  pthread_t* pThreads = calloc(nThreads, sizeof(pthread_t));
+  for (unsigned t = 0; t < nThreads; t++)
+  {
+    pTasks[t].pExplorer = &explorer;
+    pTasks[t].iFirst = explorer.nStates * t / nThreads;
+    pTasks[t].iLast = explorer.nStates * (t + 1) / nThreads;
+    pTasks[t].bThread = pthread_create(&pThreads[t], NULL, stepStates, &pTasks[t]) == 0;
+  }
+  uint64_t pFirstOutput[MINI_MAX] = { 0 };
+  for (unsigned t = 0; t < nThreads; t++)
+  {
+    // A range whose thread could not be started is stepped here
+    if (pTasks[t].bThread)
+      pthread_join(pThreads[t], NULL);
+    else
+      stepStates(&pTasks[t]);
+    for (unsigned v = 0; v < MINI_MAX; v++)
+      pFirstOutput[v] += pTasks[t].pFirstOutput[v];
+  }
+  fprintf(stderr, "Stepped every state in %.2f s\n", elapsed(&start));
+
+  uint64_t nReached = 0;
+  uint64_t nMultiple = 0;
+  for (size_t w = 0; w < nWords; w++)
+  {
+    nReached += (uint64_t)__builtin_popcountll(explorer.pOnce[w]);
+    nMultiple += (uint64_t)__builtin_popcountll(explorer.pTwice[w]);
+  }
+
+  // Walk the functional graph. Each walk marks its path until it meets an earlier walk (a tail)
+  // or itself (a new cycle), then marks the path visited.
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  size_t nCycles = 0;
+  size_t nCapacity = 1024;
+  uint64_t* pLengths = malloc(nCapacity * sizeof(uint64_t));
+  uint64_t nCyclic = 0;
+  uint64_t pCycleOutput[MINI_MAX] = { 0 };
+  unsigned char pCards[MINI_MAX];
+  for (uint64_t s = 0; s < explorer.nStates; s++)
+  {
+    if (s % PROGRESS_STEP == 0 && s > 0)
+      fprintf(stderr, "  %.1f%% walked, %zu cycles\n", 100.0 * (double)s / (double)explorer.nStates, nCycles);
+    if (testBit(pVisited, s))
+      continue;
+
+    uint64_t i = s;
+    while (!testBit(pVisited, i) && !testBit(pOnPath, i))
+    {
+      setBit(pOnPath, i);
+      i = successor(&explorer, i);
+    }
+
+    if (testBit(pOnPath, i))
+    {
+      // i is on this walk's own path, so it is on a new cycle
+      uint64_t iLength = 0;
+      uint64_t j = i;
+      do
+      {
+        unrankCards(&explorer, j, pCards);
+        pCycleOutput[miniOutput(pCards, n)]++;
+        iLength++;
+        j = successor(&explorer, j);
+      }
+      while (j != i);
+
+      if (nCycles == nCapacity)
+      {
+        nCapacity *= 2;
+        pLengths = realloc(pLengths, nCapacity * sizeof(uint64_t));
+      }
+      pLengths[nCycles++] = iLength;
+      nCyclic += iLength;
+    }
+
+    for (uint64_t j = s; testBit(pOnPath, j); j = successor(&explorer, j))
+    {
+      clearBit(pOnPath, j);
+      setBit(pVisited, j);
+    }
+  }
+  fprintf(stderr, "Walked every state in %.2f s\n", elapsed(&start));
+
+  printf("In-degree 0: %llu states\n", (unsigned long long)(explorer.nStates - nReached));
+  printf("In-degree 1: %llu states\n", (unsigned long long)(nReached - nMultiple));
+  printf("In-degree 2 or more: %llu states\n", (unsigned long long)nMultiple);
+  printf("%zu cycles covering %llu states (%.4f%%)\n", nCycles, (unsigned long long)nCyclic,
+         100.0 * (double)nCyclic / (double)explorer.nStates);
+
+  printf("\nCycle length   cycles   states\n");
+  qsort(pLengths, nCycles, sizeof(uint64_t), compareLengths);
+  for (size_t i = 0; i < nCycles; )
+  {
+    size_t j = i;
+    while (j < nCycles && pLengths[j] == pLengths[i])
+      j++;
+    printf("%12llu %8zu %8llu\n", (unsigned long long)pLengths[i], j - i, (unsigned long long)(pLengths[i] * (j - i)));
+    i = j;
+  }
+
+  unsigned nValues = n - 2;
+  printHistogram("First output from every state", pFirstOutput, nValues, explorer.nStates);
+  printHistogram("Output of every state on a cycle", pCycleOutput, nValues, nCyclic);
+
+  free(pLengths);
+  free(pTasks);
+  free(pThreads);
+  free(explorer.pSuccessors);
+  free(explorer.pOnce);
+  free(explorer.pTwice);
+  free(pVisited);
+  free(pOnPath);
+  return EXIT_SUCCESS;
+}
+
+void usage()
+{
+  fprintf(stderr, "Usage: solitaire-explore [-n cards (3-%u)] [-j threads]\n", EXPLORE_MAX);
+}
+
+/* Lexicographic rank of an ordering of cards 1 to n */
+uint64_t rankCards(explorer_t* pExplorer, const unsigned char* pCards)
+{
+  unsigned n = pExplorer->n;
+  uint64_t iRank = 0;
+  for (unsigned i = 0; i < n; i++)
+  {
+    unsigned nSmaller = 0;
+    for (unsigned j = i + 1; j < n; j++)
+      nSmaller += pCards[j] < pCards[i];
+    iRank += nSmaller * pExplorer->pFactorials[n - 1 - i];
+  }
+  return iRank;
+}
+
+/* The ordering of cards 1 to n with lexicographic rank iRank */
+void unrankCards(explorer_t* pExplorer, uint64_t iRank, unsigned char* pCards)
+{
+  unsigned n = pExplorer->n;
+  unsigned char pLeft[MINI_MAX];
+  for (unsigned i = 0; i < n; i++)
+    pLeft[i] = (unsigned char)(i + 1);
+  for (unsigned i = 0; i < n; i++)
+  {
+    uint64_t iFactorial = pExplorer->pFactorials[n - 1 - i];
+    unsigned iDigit = (unsigned)(iRank / iFactorial);
+    iRank %= iFactorial;
+    pCards[i] = pLeft[iDigit];
+    memmove(pLeft + iDigit, pLeft + iDigit + 1, n - 1 - i - iDigit);
+  }
+}
+
+/* Advance to the next ordering in lexicographic order, i.e. the next rank */
+void nextCards(unsigned char* pCards, unsigned n)
+{
+  int i = (int)n - 2;
+  while (i >= 0 && pCards[i] > pCards[i + 1])
+    i--;
+  if (i < 0)
+    return;
+  int j = (int)n - 1;
+  while (pCards[j] < pCards[i])
+    j--;
+  unsigned char iTemp = pCards[i];
+  pCards[i] = pCards[j];
+  pCards[j] = iTemp;
+  for (int a = i + 1, b = (int)n - 1; a < b; a++, b--)
+  {
+    iTemp = pCards[a];
+    pCards[a] = pCards[b];
+    pCards[b] = iTemp;
+  }
+}
+
+/* Rank of the state one deck step after iRank */
+uint64_t successor(explorer_t* pExplorer, uint64_t iRank)
+{
+  if (pExplorer->pSuccessors != NULL)
+    return pExplorer->pSuccessors[iRank];
+
+  unsigned char pCards[MINI_MAX];
+  unrankCards(pExplorer, iRank, pCards);
+  miniStep(pCards, pExplorer->n);
+  return rankCards(pExplorer, pCards);
+}
+
+/* Worker thread: step the states iFirst to iLast-1, visiting them in rank order */
+void* stepStates(void* pArg)
+{
+  stepTask_t* pTask = pArg;
+  explorer_t* pExplorer = pTask->pExplorer;
+  unsigned n = pExplorer->n;
+  unsigned char pCards[MINI_MAX];
+  unsigned char pNext[MINI_MAX];
+  unrankCards(pExplorer, pTask->iFirst, pCards);
+
+  for (uint64_t s = pTask->iFirst; s < pTask->iLast; s++)
+  {
+    memcpy(pNext, pCards, n);
+    miniStep(pNext, n);
+    uint64_t iNext = rankCards(pExplorer, pNext);
+    if (pExplorer->pSuccessors != NULL)
+      pExplorer->pSuccessors[s] = (uint32_t)iNext;
+    pTask->pFirstOutput[miniOutput(pNext, n)]++;
+
+    // Saturating in-degree: the second arrival sets the second bitmap
+    uint64_t iBit = 1ULL << (iNext % 64);
+    if (atomic_fetch_or_explicit(&pExplorer->pOnce[iNext / 64], iBit, memory_order_relaxed) & iBit)
+      atomic_fetch_or_explicit(&pExplorer->pTwice[iNext / 64], iBit, memory_order_relaxed);
+
+    nextCards(pCards, n);
+  }
+  return NULL;
+}
+
+int compareLengths(const void* pA, const void* pB)
+{
+  uint64_t a = *(const uint64_t*)pA;
+  uint64_t b = *(const uint64_t*)pB;
+  return (a > b) - (a < b);
+}
+
+/* Print the count of each output value (0 is a Joker) and its deviation from uniform */
+void printHistogram(const char* pTitle, uint64_t* pCounts, unsigned nValues, uint64_t nTotal)
+{
+  uint64_t nOutputs = nTotal - pCounts[0];
+  printf("\n%s: %llu Joker outputs (%.4f%%)\n", pTitle, (unsigned long long)pCounts[0],
+         nTotal == 0 ? 0.0 : 100.0 * (double)pCounts[0] / (double)nTotal);
+  printf("value        count  share    bias\n");
+  for (unsigned v = 1; v <= nValues; v++)
+  {
+    double share = nOutputs == 0 ? 0.0 : (double)pCounts[v] / (double)nOutputs;
+    printf("%5u %12llu %6.3f%% %+7.3f%%\n", v, (unsigned long long)pCounts[v], 100.0 * share,
+           100.0 * (share * nValues - 1.0));
+  }
+}
+
+double elapsed(struct timespec* pStart)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)(now.tv_sec - pStart->tv_sec) + (double)(now.tv_nsec - pStart->tv_nsec) / 1e9;
+}
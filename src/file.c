@@ -87,22 +87,67 @@ bool parseFile(char* pFile, char** pInput, char** pKey)
   return true;
 }
 
+/* Read the first line of the key file pFile into an allocated, null-terminated string.
+   Any trailing line break is removed. Returns false if the file could not be read or the line was blank. */
+bool parseKeyFile(char* pFile, char** pKey)
+{
+  assert(pKey != NULL);
+  assert(*pKey == NULL);
+
+  FILE* f = fopen(pFile, "r");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Error opening key file '%s': %s.\n", pFile, strerror(errno));
+    return false;
+  }
+
+  char pKeyText[1000] = { 0 }; // Raw key text
+  if (fgets(pKeyText, 1000, f) == NULL)
+    pKeyText[0] = '\0';
+
+  if (fclose(f) != 0)
+  {
+    fprintf(stderr, "Error closing key file '%s': %s\n", pFile, strerror(errno));
+    return false;
+  }
+
+  if (strlen(pKeyText) > 0 && pKeyText[strlen(pKeyText) - 1] == '\n')
+    pKeyText[strlen(pKeyText) - 1] = '\0';
+
+  if (strlen(pKeyText) == 0)
+  {
+    fprintf(stderr, "Key file '%s' was blank\n", pFile);
+    return false;
+  }
+
+  size_t iLen = strlen(pKeyText) + 1;
+  *pKey = malloc(iLen * sizeof(char));
+  strncpy(*pKey, pKeyText, iLen);
+  return true;
+}
+
 /* Clean the input text to an alpha-only, all caps, null-terminated string. */
 void cleanInput(char* pInput)
 {
-  size_t iLen = strlen(pInput);
-
   // Overwrite the input array with the cleaned array, appending the null terminator
+  pInput[cleanBuffer(pInput, strlen(pInput))] = '\0';
+}
+
+/* Clean iLen chars of pBuffer in place to alpha-only, all caps chars.
+   The buffer does not need to be null-terminated and no terminator is appended.
+   Returns the cleaned length. */
+size_t cleanBuffer(char* pBuffer, size_t iLen)
+{
   size_t iFinal = 0;
   for (size_t i = 0; i < iLen; i++)
   {
-    if (isalpha(pInput[i]))
+    if (isalpha((unsigned char)pBuffer[i]))
     {
-      pInput[iFinal] = toupper(pInput[i]);
+      pBuffer[iFinal] = toupper((unsigned char)pBuffer[i]);
       iFinal++;
     }
   }
-  pInput[iFinal] = '\0';
+  return iFinal;
 }
 
 /* Convert the input alpha key to an allocated array of numbers. The returned size_t is the length of the array.
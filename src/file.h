@@ -2,6 +2,8 @@
 #include "deck.h"
 
 bool parseFile(char* pFile, char** pInput, char** pKey);
+bool parseKeyFile(char* pFile, char** pKey);
 void cleanInput(char* pInput);
+size_t cleanBuffer(char* pBuffer, size_t iLen);
 size_t cleanAlphaKey(char* pKey, int** pNum);
 size_t cleanDeckKey(char* pKey, int** pNum);
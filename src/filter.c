@@ -0,0 +1,378 @@
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cipher.h"
+#include "file.h"
+#include "filter.h"
+#include "session.h"
+#include "trace.h"
+
+/* Records are read in batches, ciphered (possibly in parallel) and written out in input order */
+#define BATCH_SIZE 4096
+#define READ_SIZE 65536 // Bytes asked of read() at a time
+
+struct record_tag
+{
+  char*  pMessage; // Cleaned and ciphered in place
+  size_t iLen;     // Length of the ciphered message, 0 on error
+  char*  pKey;
+  char*  pMode;
+  bool   bOk;
+};
+typedef struct record_tag record_t;
+
+struct worker_tag
+{
+  pthread_t       thread;
+  bool            bThread;    // False if the thread could not be started and its records are run inline
+  record_t*       pRecords;   // The whole batch
+  size_t*         pIndices;   // Indices of this worker's records in the batch, in input order
+  size_t          nIndices;
+  size_t          iFirstLine; // Input line number of the batch's first record, for error messages
+  cacheEntry_t*   pCache;
+  sessionStore_t* pStore;     // NULL if session keys are not enabled
+};
+typedef struct worker_tag worker_t;
+
+/* Lines are read straight from the input's descriptor, so a batch can stop at the last complete line
+   that has arrived instead of blocking for a full batch */
+struct reader_tag
+{
+  int    fd;
+  char*  pBuf;
+  size_t iSize;
+  size_t iStart; // First byte not yet returned
+  size_t iScan;  // Bytes from iStart already searched for a newline
+  size_t iEnd;   // End of the bytes read
+  bool   bEof;
+  bool   bError;
+};
+typedef struct reader_tag reader_t;
+
+int readLine(reader_t* pReader, bool bBlock, char** ppLine, size_t* pLen);
+bool splitRecord(char* pLine, record_t* pRecord);
+void* filterWorker(void* pArg);
+void filterRecord(record_t* pRecord, worker_t* pWorker, size_t iLine);
+bool filterSession(record_t* pRecord, worker_t* pWorker, bool bEncrypt, bool isDeck, size_t iLine);
+
+/* Read newline-delimited records from fIn and write one result line per record to fOut.
+   Each record is 'message<TAB>key<TAB>mode', where mode is 'e' to encrypt or 'd' to decrypt,
+   followed by 'k' if the key is key text rather than a deck order. The result line is the cleaned
+   output text, or '!' if the record was invalid. Records are spread over nThreads workers,
+   but results are always written in input order. A batch takes the records that have already arrived, up to
+   BATCH_SIZE, and its results are flushed before the next batch is read, so an interactive producer gets each
+   answer without having to send a full batch first. fIn is read through its file descriptor, not through stdio.
+   If pStore is not NULL, a key of '@id=key' starts session id with that key/deck and a key of '@id'
+   continues the session's keystream. Every record of a session goes to the same worker, so a session's
+   records are always ciphered in input order. */
+bool runFilter(FILE* fIn, FILE* fOut, unsigned nThreads, sessionStore_t* pStore)
+{
+  if (nThreads == 0)
+    nThreads = 1;
+
+  worker_t* pWorkers = calloc(nThreads, sizeof(worker_t));
+  for (unsigned i = 0; i < nThreads; i++)
+  {
+    pWorkers[i].pIndices = malloc(BATCH_SIZE * sizeof(size_t));
+    pWorkers[i].pCache = makeDeckCache();
+    pWorkers[i].pStore = pStore;
+  }
+
+  // One arena holds the text of a whole batch and is reused for every batch
+  record_t* pRecords = malloc(BATCH_SIZE * sizeof(record_t));
+  size_t* pOffsets = malloc(BATCH_SIZE * sizeof(size_t));
+  char* pArena = NULL;
+  size_t iArenaSize = 0;
+  reader_t reader = { fileno(fIn), malloc(READ_SIZE), READ_SIZE, 0, 0, 0, false, false };
+  char* pLine = NULL;
+  size_t iRead = 0;
+  size_t iLine = 0;
+  bool bEof = false;
+  bool bWritten = true;
+
+  while (!bEof && bWritten)
+  {
+    // Fill the batch, waiting only for its first record
+    traceBegin("read batch");
+    size_t nRecords = 0;
+    size_t iUsed = 0;
+    int iResult = 1;
+    while (nRecords < BATCH_SIZE && (iResult = readLine(&reader, nRecords == 0, &pLine, &iRead)) == 1)
+    {
+      if (iUsed + iRead + 1 > iArenaSize)
+      {
+        iArenaSize = 2 * (iUsed + iRead + 1);
+        pArena = realloc(pArena, iArenaSize);
+      }
+      memcpy(pArena + iUsed, pLine, iRead);
+      pArena[iUsed + iRead] = '\0';
+      pOffsets[nRecords++] = iUsed;
+      iUsed += iRead + 1;
+    }
+    bEof = iResult == -1;
+    traceEnd("read batch");
+    if (nRecords == 0)
+      break;
+
+    // Records point into the arena, so they are only split once the arena has stopped moving
+    for (size_t i = 0; i < nRecords; i++)
+      pRecords[i].bOk = splitRecord(pArena + pOffsets[i], &pRecords[i]);
+
+    // Hand contiguous ranges to the workers, except that session records go to the worker chosen by
+    // their session id; worker 0 runs on this thread
+    size_t iPer = (nRecords + nThreads - 1) / nThreads;
+    for (unsigned i = 0; i < nThreads; i++)
+      pWorkers[i].nIndices = 0;
+    for (size_t i = 0; i < nRecords; i++)
+    {
+      worker_t* pWorker = &pWorkers[i / iPer];
+      if (pStore != NULL && pRecords[i].bOk && pRecords[i].pKey[0] == '@')
+        pWorker = &pWorkers[strtoull(pRecords[i].pKey + 1, NULL, 10) % nThreads];
+      pWorker->pIndices[pWorker->nIndices++] = i;
+    }
+    for (unsigned i = 0; i < nThreads; i++)
+    {
+      pWorkers[i].pRecords = pRecords;
+      pWorkers[i].iFirstLine = iLine + 1;
+      pWorkers[i].bThread = i > 0 && pthread_create(&pWorkers[i].thread, NULL, filterWorker, &pWorkers[i]) == 0;
+    }
+    filterWorker(&pWorkers[0]);
+    for (unsigned i = 1; i < nThreads; i++)
+    {
+      if (pWorkers[i].bThread)
+        pthread_join(pWorkers[i].thread, NULL);
+      else
+        filterWorker(&pWorkers[i]);
+    }
+
+    traceBegin("write batch");
+    for (size_t i = 0; i < nRecords; i++)
+    {
+      if (pRecords[i].bOk)
+        fwrite(pRecords[i].pMessage, sizeof(char), pRecords[i].iLen, fOut);
+      else
+        fputc('!', fOut);
+      fputc('\n', fOut);
+    }
+    bWritten = fflush(fOut) == 0;
+    traceEnd("write batch");
+    iLine += nRecords;
+  }
+
+  bool bOk = !reader.bError && bWritten;
+  if (!bOk)
+    fprintf(stderr, "Error reading records or writing results.\n");
+
+  for (unsigned i = 0; i < nThreads; i++)
+  {
+    free(pWorkers[i].pIndices);
+    freeDeckCache(pWorkers[i].pCache);
+  }
+  free(pWorkers);
+  free(pRecords);
+  free(pOffsets);
+  free(pArena);
+  free(reader.pBuf);
+  return bOk;
+}
+
+/* Set *ppLine and *pLen to the next line of input, including its newline; the line stays valid until the
+   next call. Returns 1 if there was a line, 0 if none has fully arrived and bBlock is false, or -1 at the
+   end of the input or on a read error. */
+int readLine(reader_t* pReader, bool bBlock, char** ppLine, size_t* pLen)
+{
+  while (true)
+  {
+    char* pStart = pReader->pBuf + pReader->iStart;
+    char* pNewline = memchr(pStart + pReader->iScan, '\n', pReader->iEnd - pReader->iStart - pReader->iScan);
+    pReader->iScan = pReader->iEnd - pReader->iStart;
+    if (pNewline != NULL || (pReader->bEof && pReader->iScan > 0))
+    {
+      // The last line of the input may have no newline
+      *ppLine = pStart;
+      *pLen = pNewline != NULL ? (size_t)(pNewline - pStart) + 1 : pReader->iScan;
+      pReader->iStart += *pLen;
+      pReader->iScan = 0;
+      return 1;
+    }
+    if (pReader->bEof)
+      return -1;
+
+    struct pollfd poller = { pReader->fd, POLLIN, 0 };
+    if (!bBlock && poll(&poller, 1, 0) == 0)
+      return 0;
+
+    // Keep the partial line at the front and make room after it
+    memmove(pReader->pBuf, pStart, pReader->iScan);
+    pReader->iStart = 0;
+    pReader->iEnd = pReader->iScan;
+    if (pReader->iSize - pReader->iEnd < READ_SIZE)
+    {
+      pReader->iSize = pReader->iEnd + READ_SIZE > 2 * pReader->iSize ? pReader->iEnd + READ_SIZE : 2 * pReader->iSize;
+      pReader->pBuf = realloc(pReader->pBuf, pReader->iSize);
+    }
+
+    ssize_t iRead = read(pReader->fd, pReader->pBuf + pReader->iEnd, pReader->iSize - pReader->iEnd);
+    if (iRead > 0)
+      pReader->iEnd += (size_t)iRead;
+    else if (iRead == 0)
+      pReader->bEof = true;
+    else if (errno != EINTR)
+      pReader->bError = pReader->bEof = true;
+  }
+}
+
+/* Split a line in place into its message, key and mode fields. Returns false if a field is missing. */
+bool splitRecord(char* pLine, record_t* pRecord)
+{
+  size_t iLen = strlen(pLine);
+  while (iLen > 0 && (pLine[iLen - 1] == '\n' || pLine[iLen - 1] == '\r'))
+    pLine[--iLen] = '\0';
+
+  pRecord->pMessage = pLine;
+  pRecord->iLen = 0;
+  pRecord->pKey = strchr(pLine, '\t');
+  if (pRecord->pKey == NULL)
+    return false;
+  *pRecord->pKey++ = '\0';
+
+  pRecord->pMode = strchr(pRecord->pKey, '\t');
+  if (pRecord->pMode == NULL)
+    return false;
+  *pRecord->pMode++ = '\0';
+  return true;
+}
+
+/* Worker thread: cipher every record it was given */
+void* filterWorker(void* pArg)
+{
+  worker_t* pWorker = pArg;
+  traceBegin("cipher records");
+  for (size_t i = 0; i < pWorker->nIndices; i++)
+  {
+    size_t iRecord = pWorker->pIndices[i];
+    filterRecord(&pWorker->pRecords[iRecord], pWorker, pWorker->iFirstLine + iRecord);
+  }
+  traceEnd("cipher records");
+  return NULL;
+}
+
+/* Clean and cipher a single record in place. Sets bOk to false if the record is invalid. */
+void filterRecord(record_t* pRecord, worker_t* pWorker, size_t iLine)
+{
+  if (!pRecord->bOk)
+  {
+    fprintf(stderr, "Record %zu: expected 'message<TAB>key<TAB>mode'.\n", iLine);
+    return;
+  }
+
+  bool bEncrypt = true;
+  bool isDeck = true;
+  if (!parseMode(pRecord->pMode, &bEncrypt, &isDeck))
+  {
+    fprintf(stderr, "Record %zu: mode must be 'e', 'd', 'ek' or 'dk', not '%s'.\n", iLine, pRecord->pMode);
+    pRecord->bOk = false;
+    return;
+  }
+  if (pWorker->pStore != NULL && pRecord->pKey[0] == '@')
+  {
+    pRecord->bOk = filterSession(pRecord, pWorker, bEncrypt, isDeck, iLine);
+    return;
+  }
+
+  packed_t deck;
+  if (!cachedDeck(pWorker->pCache, pRecord->pKey, isDeck, &deck))
+  {
+    fprintf(stderr, "Record %zu: invalid key/deck.\n", iLine);
+    pRecord->bOk = false;
+    return;
+  }
+
+  pRecord->iLen = cleanBuffer(pRecord->pMessage, strlen(pRecord->pMessage));
+  cipherPacked(bEncrypt, &deck, pRecord->pMessage, pRecord->pMessage, pRecord->iLen);
+}
+
+/* Read a record's mode: 'e' or 'd', followed by 'k' if the key is key text. Returns false for anything else. */
+bool parseMode(const char* pMode, bool* pEncrypt, bool* pIsDeck)
+{
+  if ((pMode[0] != 'e' && pMode[0] != 'd') || (pMode[1] != '\0' && (pMode[1] != 'k' || pMode[2] != '\0')))
+    return false;
+  *pEncrypt = pMode[0] == 'e';
+  *pIsDeck = pMode[1] != 'k';
+  return true;
+}
+
+/* Cipher a record against a stored session. The key is '@id' or '@id=key'. */
+bool filterSession(record_t* pRecord, worker_t* pWorker, bool bEncrypt, bool isDeck, size_t iLine)
+{
+  char* pEnd = NULL;
+  uint64_t iId = strtoull(pRecord->pKey + 1, &pEnd, 10);
+  if (pEnd == pRecord->pKey + 1 || (*pEnd != '\0' && *pEnd != '='))
+  {
+    fprintf(stderr, "Record %zu: invalid session key '%s'.\n", iLine, pRecord->pKey);
+    return false;
+  }
+
+  if (*pEnd == '=')
+  {
+    packed_t deck;
+    if (!cachedDeck(pWorker->pCache, pEnd + 1, isDeck, &deck) || !sessionInit(pWorker->pStore, iId, &deck))
+    {
+      fprintf(stderr, "Record %zu: unable to start session %lu.\n", iLine, (unsigned long)iId);
+      return false;
+    }
+  }
+
+  pRecord->iLen = cleanBuffer(pRecord->pMessage, strlen(pRecord->pMessage));
+  if (!sessionCipher(pWorker->pStore, iId, bEncrypt, pRecord->pMessage, pRecord->pMessage, pRecord->iLen))
+  {
+    fprintf(stderr, "Record %zu: unable to use session %lu.\n", iLine, (unsigned long)iId);
+    return false;
+  }
+  return true;
+}
+
+/* Allocate an empty deck cache. A cache must only be used by one thread at a time. */
+cacheEntry_t* makeDeckCache()
+{
+  return calloc(CACHE_SIZE, sizeof(cacheEntry_t));
+}
+
+void freeDeckCache(cacheEntry_t* pCache)
+{
+  for (size_t i = 0; i < CACHE_SIZE; i++)
+    free(pCache[i].pKey);
+  free(pCache);
+}
+
+/* Copy the deck for pKey into pPacked, deriving it only if it is not already in the cache */
+bool cachedDeck(cacheEntry_t* pCache, const char* pKey, bool isDeck, packed_t* pPacked)
+{
+  // FNV-1a over the raw key and deck flag
+  uint64_t iHash = 14695981039346656037ULL ^ (uint64_t)isDeck;
+  for (const char* p = pKey; *p != '\0'; p++)
+    iHash = (iHash ^ (unsigned char)*p) * 1099511628211ULL;
+
+  cacheEntry_t* pEntry = &pCache[iHash % CACHE_SIZE];
+  if (pEntry->pKey != NULL && pEntry->iHash == iHash && pEntry->isDeck == isDeck && strcmp(pEntry->pKey, pKey) == 0)
+  {
+    *pPacked = pEntry->deck;
+    return true;
+  }
+
+  if (!keyToPacked(pKey, isDeck, pPacked))
+    return false;
+
+  free(pEntry->pKey);
+  pEntry->pKey = strdup(pKey);
+  pEntry->iHash = iHash;
+  pEntry->isDeck = isDeck;
+  pEntry->deck = *pPacked;
+  return true;
+}
@@ -0,0 +1,26 @@
+#ifndef FILTER_H
+#define FILTER_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "packed.h"
+#include "session.h"
+
+#define CACHE_SIZE 1024 // Derived decks cached per worker, direct mapped
+
+struct cacheEntry_tag
+{
+  uint64_t iHash;
+  char*    pKey; // Allocated copy of the raw key, NULL if the entry is empty
+  bool     isDeck;
+  packed_t deck;
+};
+typedef struct cacheEntry_tag cacheEntry_t;
+
+bool runFilter(FILE* fIn, FILE* fOut, unsigned nThreads, sessionStore_t* pStore);
+bool parseMode(const char* pMode, bool* pEncrypt, bool* pIsDeck);
+cacheEntry_t* makeDeckCache();
+void freeDeckCache(cacheEntry_t* pCache);
+bool cachedDeck(cacheEntry_t* pCache, const char* pKey, bool isDeck, packed_t* pPacked);
+#endif
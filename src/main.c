@@ -1,32 +1,148 @@
 #include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 #include "cipher.h"
+#include "container.h"
+#include "dir.h"
+#include "engine.h"
+#include "filter.h"
+#include "pad.h"
+#include "pipeline.h"
+#include "schedule.h"
+#include "shm.h"
+#include "trace.h"
+
+#define MAX_THREADS 1024 // Upper bound for -j
+
+enum
+{
+  OPT_ENGINE = 256,
+  OPT_ENGINE_BENCH
+};
+
+static const struct option LONG_OPTIONS[] =
+{
+  { "engine",       required_argument, NULL, OPT_ENGINE },
+  { "engine-bench", no_argument,       NULL, OPT_ENGINE_BENCH },
+  { NULL,           0,                 NULL, 0 }
+};
+
+static bool parseNumber(const char* pArg, int iOption, uint64_t iMax, uint64_t* pValue);
 
 int main (int argc, char **argv)
 {
   bool bEncrypt = true;
   bool isDeck = true;
+  bool bPipeline = false;
+  bool bFilter = false;
+  bool bDirectory = false;
+  bool bBinary = false;
+  bool bContainer = false;
+  unsigned nThreads = 1;
+  char* pSessionFile = NULL;
+  uint64_t nSessions = 1000000;
   char* pOutput = NULL;
+  char* pKeyFile = NULL;
+  char* pPadFile = NULL;
+  char* pLongKey = NULL;
+  char* pStateFile = NULL;
+  bool bGenerate = false;
+  uint64_t iPadCount = 0;
+  uint64_t iPadOffset = PAD_NEXT;
+  char* pServiceName = NULL;
+  char* pClientName = NULL;
+  char* pEngine = NULL;
+  bool bEngineBench = false;
   int c = -1;
 
-  while ((c = getopt(argc, argv, "dko:")) != -1)
+  while ((c = getopt_long(argc, argv, "C:dDfg:j:kK:L:N:o:O:pP:Q:s:S:T:xz", LONG_OPTIONS, NULL)) != -1)
   {
     switch (c)
     {
+    case OPT_ENGINE:
+      pEngine = optarg;
+      break;
+    case OPT_ENGINE_BENCH:
+      bEngineBench = true;
+      break;
+    case 'C':
+      pClientName = optarg;
+      break;
     case 'd':
       bEncrypt = false;
       break;
+    case 'D':
+      bDirectory = true;
+      break;
+    case 'f':
+      bFilter = true;
+      break;
+    case 'g':
+      bGenerate = true;
+      if (!parseNumber(optarg, c, UINT64_MAX, &iPadCount))
+        return EXIT_FAILURE;
+      break;
+    case 'j':
+    {
+      uint64_t iThreads = 0;
+      if (!parseNumber(optarg, c, MAX_THREADS, &iThreads))
+        return EXIT_FAILURE;
+      nThreads = (unsigned)iThreads;
+      break;
+    }
     case 'k':
       isDeck = false;
       break;
+    case 'K':
+      pKeyFile = optarg;
+      break;
+    case 'L':
+      pLongKey = optarg;
+      break;
+    case 'N':
+      if (!parseNumber(optarg, c, UINT64_MAX, &nSessions))
+        return EXIT_FAILURE;
+      break;
     case 'o':
       pOutput = optarg;
       break;
+    case 'O':
+      if (!parseNumber(optarg, c, PAD_NEXT - 1, &iPadOffset))
+        return EXIT_FAILURE;
+      break;
+    case 'p':
+      bPipeline = true;
+      break;
+    case 'P':
+      pPadFile = optarg;
+      break;
+    case 'Q':
+      pServiceName = optarg;
+      break;
+    case 's':
+      pStateFile = optarg;
+      break;
+    case 'S':
+      pSessionFile = optarg;
+      break;
+    case 'T':
+      traceStart(optarg);
+      traceThreadName("main");
+      break;
+    case 'x':
+      bBinary = true;
+      bPipeline = true;
+      break;
+    case 'z':
+      bContainer = true;
+      break;
     case '?':
-      if (optopt == 'o')
+      if (optopt == 'o' || optopt == 'K' || optopt == 'L' || optopt == 's' || optopt == 'g' || optopt == 'j' || optopt == 'N' || optopt == 'S' || optopt == 'T' || optopt == 'O' || optopt == 'P' || optopt == 'Q' || optopt == 'C')
         fprintf (stderr, "Option -%o requires an argument.\n", optopt);
       else if (isprint (optopt))
         fprintf (stderr, "Unknown option `-%c'.\n", optopt);
@@ -38,6 +154,78 @@ int main (int argc, char **argv)
     }
   }
 
+  // Choose the keystream engine before any worker threads start
+  if (engineSelect(pEngine, bEngineBench) == NULL)
+  {
+    size_t nEngines = 0;
+    const engine_t* pEngines = engineList(&nEngines);
+    fprintf(stderr, "Available engines:");
+    for (size_t i = 0; i < nEngines; i++)
+      fprintf(stderr, " %s%s", pEngines[i].pName, pEngines[i].supported() ? "" : " (unsupported)");
+    fprintf(stderr, "\n");
+    return EXIT_FAILURE;
+  }
+
+  // Filter mode reads records from stdin and writes results to stdout
+  if (bFilter)
+  {
+    sessionStore_t* pStore = NULL;
+    if (pSessionFile != NULL && (pStore = openSessionStore(pSessionFile, nSessions, true)) == NULL)
+      return EXIT_FAILURE;
+
+    bool bOk = runFilter(stdin, stdout, nThreads, pStore);
+    if (!closeSessionStore(pStore))
+      bOk = false;
+    return bOk ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Shared memory service mode serves co-located clients until interrupted
+  if (pServiceName != NULL)
+  {
+    // Workers take requests in any order, so only one can keep each session's records in the order they arrive
+    if (pSessionFile != NULL && nThreads > 1)
+    {
+      fprintf(stderr, "A service with a session store (-S) runs one worker; -j %u cannot be used with it.\n", nThreads);
+      return EXIT_FAILURE;
+    }
+
+    sessionStore_t* pStore = NULL;
+    if (pSessionFile != NULL && (pStore = openSessionStore(pSessionFile, nSessions, true)) == NULL)
+      return EXIT_FAILURE;
+
+    bool bOk = runShmService(pServiceName, nThreads, pStore);
+    if (!closeSessionStore(pStore))
+      bOk = false;
+    return bOk ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Shared memory client mode sends filter records from stdin to a running service
+  if (pClientName != NULL)
+    return runShmClient(pClientName, stdin, stdout) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  // Key schedule mode streams a key of any length into a deck file
+  if (pLongKey != NULL)
+  {
+    if (!runKeySchedule(pLongKey, pStateFile, pOutput))
+      return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+  }
+
+  // Pad generation only needs the key file
+  if (bGenerate)
+  {
+    if (!generatePad(pKeyFile, isDeck, iPadOffset == PAD_NEXT ? 0 : iPadOffset, iPadCount, pOutput))
+      return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+  }
+
+  // Directory mode reads each file's key from the file itself and writes plain summaries
+  if (bDirectory && (pKeyFile != NULL || pPadFile != NULL || bContainer || bPipeline))
+  {
+    fprintf(stderr, "Directory mode (-D) cannot be combined with -K, -P, -z, -p or -x.\n");
+    return EXIT_FAILURE;
+  }
+
   char* pInput = NULL;
   for (int index = optind; index < argc; index++)
   {
@@ -58,8 +246,43 @@ int main (int argc, char **argv)
     return EXIT_FAILURE;
   }
 
-  if (!run(pInput, bEncrypt, isDeck, pOutput))
+  if (bDirectory)
+  {
+    if (!runDirectory(pInput, bEncrypt, isDeck, nThreads, pOutput))
+      return EXIT_FAILURE;
+  }
+  else if (pPadFile != NULL)
+  {
+    if (!runPad(pInput, pPadFile, iPadOffset, bEncrypt, pOutput))
+      return EXIT_FAILURE;
+  }
+  else if (bContainer)
+  {
+    if (!runContainer(pInput, pKeyFile, bEncrypt, isDeck, pOutput))
+      return EXIT_FAILURE;
+  }
+  else if (bPipeline)
+  {
+    if (!runPipeline(pInput, pKeyFile, bEncrypt, isDeck, bBinary, pOutput))
+      return EXIT_FAILURE;
+  }
+  else if (!run(pInput, bEncrypt, isDeck, pOutput))
     return EXIT_FAILURE;
 
   return EXIT_SUCCESS;
 }
+
+/* Parse the whole of pArg, the argument of option iOption, as a decimal number from 0 to iMax */
+static bool parseNumber(const char* pArg, int iOption, uint64_t iMax, uint64_t* pValue)
+{
+  char* pEnd = NULL;
+  errno = 0;
+  unsigned long long iValue = strtoull(pArg, &pEnd, 10);
+  if (!isdigit((unsigned char)pArg[0]) || *pEnd != '\0' || errno == ERANGE || iValue > iMax)
+  {
+    fprintf(stderr, "Option -%c expects a number from 0 to %" PRIu64 ", not '%s'.\n", iOption, iMax, pArg);
+    return false;
+  }
+  *pValue = iValue;
+  return true;
+}
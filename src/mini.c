@@ -0,0 +1,78 @@
+#include <assert.h>
+#include <string.h>
+
+#include "mini.h"
+
+/* Count cut value of a card: its own number, or n-1 for either Joker */
+unsigned miniCutValue(unsigned iCard, unsigned n)
+{
+  return iCard >= n - 1 ? n - 1 : iCard;
+}
+
+/* Output value of a card, or 0 for a Joker */
+unsigned miniOutValue(unsigned iCard, unsigned n)
+{
+  if (iCard >= n - 1)
+    return 0;
+  unsigned iModulus = (n == 54) ? 26 : n - 2;
+  return (iCard - 1) % iModulus + 1;
+}
+
+/* Move a Joker down iShift places, wrapping around to just below the top card */
+static void miniMoveJoker(unsigned char* pCards, unsigned n, unsigned char iJoker, unsigned iShift)
+{
+  unsigned iFrom = (unsigned)((unsigned char*)memchr(pCards, iJoker, n) - pCards);
+  unsigned iTo = iFrom + iShift;
+  if (iTo >= n)
+    iTo = iTo - n + 1;
+
+  if (iTo > iFrom)
+    memmove(pCards + iFrom, pCards + iFrom + 1, iTo - iFrom);
+  else
+    memmove(pCards + iTo + 1, pCards + iTo, iFrom - iTo);
+  pCards[iTo] = iJoker;
+}
+
+/* Move the Jokers, triple cut and count cut by the bottom card */
+void miniStep(unsigned char* pCards, unsigned n)
+{
+  assert(n >= 3 && n <= MINI_MAX);
+  miniMoveJoker(pCards, n, (unsigned char)(n - 1), 1);
+  miniMoveJoker(pCards, n, (unsigned char)n, 2);
+
+  // Triple cut
+  unsigned iA = (unsigned)((unsigned char*)memchr(pCards, n - 1, n) - pCards);
+  unsigned iB = (unsigned)((unsigned char*)memchr(pCards, n, n) - pCards);
+  unsigned iFirst = iA < iB ? iA : iB;
+  unsigned iSecond = iA < iB ? iB : iA;
+  unsigned char pTemp[2 * MINI_MAX];
+  unsigned iBottom = n - 1 - iSecond;
+  memcpy(pTemp, pCards + iSecond + 1, iBottom);
+  memcpy(pTemp + iBottom, pCards + iFirst, iSecond - iFirst + 1);
+  memcpy(pTemp + iBottom + iSecond - iFirst + 1, pCards, iFirst);
+
+  // Count cut: rotate the top n-1 cards by the bottom card's value
+  unsigned iValue = miniCutValue(pTemp[n - 1], n);
+  memcpy(pCards, pTemp + iValue, n - 1 - iValue);
+  memcpy(pCards + n - 1 - iValue, pTemp, iValue);
+  pCards[n - 1] = pTemp[n - 1];
+}
+
+/* The output of the current deck without stepping: the value of the card counted down by the top card */
+unsigned miniOutput(const unsigned char* pCards, unsigned n)
+{
+  return miniOutValue(pCards[miniCutValue(pCards[0], n)], n);
+}
+
+/* Step until a non-Joker output is found and return it */
+unsigned miniKeystream(unsigned char* pCards, unsigned n)
+{
+  unsigned iOut = 0;
+  do
+  {
+    miniStep(pCards, n);
+    iOut = miniOutput(pCards, n);
+  }
+  while (iOut == 0);
+  return iOut;
+}
@@ -0,0 +1,16 @@
+#ifndef MINI_H
+#define MINI_H
+#include <stdlib.h>
+
+/* Reduced-size decks of n cards (3 to 54) with the same rules as deck.c.
+   Cards 1 to n-2 are ordinary cards, card n-1 is the "A" Joker and card n is the "B" Joker.
+   Jokers count n-1 when cutting. A card's output is its number reduced to 1-26 for a full deck,
+   or the number itself for a reduced deck. Jokers have no output. */
+#define MINI_MAX 54
+
+unsigned miniCutValue(unsigned iCard, unsigned n);
+unsigned miniOutValue(unsigned iCard, unsigned n);
+void miniStep(unsigned char* pCards, unsigned n);
+unsigned miniOutput(const unsigned char* pCards, unsigned n);
+unsigned miniKeystream(unsigned char* pCards, unsigned n);
+#endif
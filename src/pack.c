@@ -0,0 +1,221 @@
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define PACK_X86
+#endif
+
+#include "pack.h"
+
+/* 5-bit packers. Eight values always fill exactly five bytes, so every packer works on groups of eight
+   from a byte boundary and finishes the last few values with the scalar code. The BMI2 packer moves a
+   group with one pext or pdep. The AVX2 packer handles 32 values at a time, merging or splitting the
+   bit fields with multiplies, shifts and byte shuffles. pack5() and unpack5() use the most preferred
+   packer this CPU supports. */
+
+#define GROUP_MASK 0x1F1F1F1F1F1F1F1FULL // The low five bits of each of eight bytes
+
+static bool scalarSupported(void);
+static void scalarPack(const unsigned char* pValues, size_t iCount, unsigned char* pOut);
+static void scalarUnpack(const unsigned char* pIn, size_t iBit, size_t iCount, unsigned char* pValues);
+#ifdef PACK_X86
+static bool bmi2Supported(void);
+static bool avx2Supported(void);
+static void bmi2Pack(const unsigned char* pValues, size_t iCount, unsigned char* pOut);
+static void bmi2Unpack(const unsigned char* pIn, size_t iBit, size_t iCount, unsigned char* pValues);
+static void avx2Pack(const unsigned char* pValues, size_t iCount, unsigned char* pOut);
+static void avx2Unpack(const unsigned char* pIn, size_t iBit, size_t iCount, unsigned char* pValues);
+#endif
+
+/* In order of preference */
+static const packer_t PACKERS[] =
+{
+#ifdef PACK_X86
+  { "avx2",   avx2Supported,   avx2Pack,   avx2Unpack },
+  { "bmi2",   bmi2Supported,   bmi2Pack,   bmi2Unpack },
+#endif
+  { "scalar", scalarSupported, scalarPack, scalarUnpack },
+};
+#define NUM_PACKERS (sizeof(PACKERS) / sizeof(PACKERS[0]))
+
+static _Atomic(const packer_t*) gPacker = NULL;
+
+static const packer_t* currentPacker();
+
+/* Return every packer compiled in, supported by this CPU or not */
+const packer_t* packerList(size_t* pCount)
+{
+  *pCount = NUM_PACKERS;
+  return PACKERS;
+}
+
+/* Pack iCount values (0-31) into a little-endian bit stream, 5 bits each.
+   Value i occupies bits 5*i to 5*i+4 of pOut, least significant bit first.
+   pOut must hold PACKED_SIZE(iCount) bytes; unused bits of the last byte are zeroed. */
+void pack5(const unsigned char* pValues, size_t iCount, unsigned char* pOut)
+{
+  currentPacker()->pack(pValues, iCount, pOut);
+}
+
+/* Unpack iCount 5-bit values from pIn, starting at bit iBit, into pValues */
+void unpack5(const unsigned char* pIn, size_t iBit, size_t iCount, unsigned char* pValues)
+{
+  currentPacker()->unpack(pIn, iBit, iCount, pValues);
+}
+
+/* The first packer in PACKERS this CPU supports, chosen once */
+static const packer_t* currentPacker()
+{
+  const packer_t* pPacker = atomic_load_explicit(&gPacker, memory_order_acquire);
+  if (pPacker == NULL)
+  {
+    for (size_t i = 0; i < NUM_PACKERS && pPacker == NULL; i++)
+    {
+      if (PACKERS[i].supported())
+        pPacker = &PACKERS[i];
+    }
+    atomic_store_explicit(&gPacker, pPacker, memory_order_release);
+  }
+  return pPacker;
+}
+
+static bool scalarSupported(void)
+{
+  return true;
+}
+
+static void scalarPack(const unsigned char* pValues, size_t iCount, unsigned char* pOut)
+{
+  memset(pOut, 0, PACKED_SIZE(iCount));
+  unsigned iAcc = 0;
+  unsigned nBits = 0;
+  size_t idx = 0;
+  for (size_t i = 0; i < iCount; i++)
+  {
+    assert(pValues[i] < 32);
+    iAcc |= (unsigned)pValues[i] << nBits;
+    nBits += 5;
+    if (nBits >= 8)
+    {
+      pOut[idx++] = (unsigned char)iAcc;
+      iAcc >>= 8;
+      nBits -= 8;
+    }
+  }
+  if (nBits > 0)
+    pOut[idx] = (unsigned char)iAcc;
+}
+
+static void scalarUnpack(const unsigned char* pIn, size_t iBit, size_t iCount, unsigned char* pValues)
+{
+  for (size_t i = 0; i < iCount; i++, iBit += 5)
+  {
+    // A value spans at most two bytes
+    unsigned iWord = pIn[iBit / 8];
+    if ((iBit % 8) > 3)
+      iWord |= (unsigned)pIn[iBit / 8 + 1] << 8;
+    pValues[i] = (iWord >> (iBit % 8)) & 0x1F;
+  }
+}
+
+#ifdef PACK_X86
+
+static bool bmi2Supported(void)
+{
+  return __builtin_cpu_supports("bmi2");
+}
+
+static bool avx2Supported(void)
+{
+  return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("bmi2")))
+static void bmi2Pack(const unsigned char* pValues, size_t iCount, unsigned char* pOut)
+{
+  size_t i = 0;
+  for (; i + 8 <= iCount; i += 8, pOut += 5)
+  {
+    uint64_t iGroup = 0;
+    memcpy(&iGroup, pValues + i, sizeof(iGroup));
+    iGroup = _pext_u64(iGroup, GROUP_MASK);
+    memcpy(pOut, &iGroup, 5);
+  }
+  scalarPack(pValues + i, iCount - i, pOut);
+}
+
+__attribute__((target("bmi2")))
+static void bmi2Unpack(const unsigned char* pIn, size_t iBit, size_t iCount, unsigned char* pValues)
+{
+  // Each group of eight reads 8 bytes from the start of its 40 bits, so stop while that stays in bounds
+  pIn += iBit / 8;
+  iBit %= 8;
+  size_t i = 0;
+  for (; i + 16 <= iCount; i += 8, pIn += 5)
+  {
+    uint64_t iGroup = 0;
+    memcpy(&iGroup, pIn, sizeof(iGroup));
+    iGroup = _pdep_u64(iGroup >> iBit, GROUP_MASK);
+    memcpy(pValues + i, &iGroup, sizeof(iGroup));
+  }
+  scalarUnpack(pIn, iBit, iCount - i, pValues + i);
+}
+
+__attribute__((target("avx2")))
+static void avx2Pack(const unsigned char* pValues, size_t iCount, unsigned char* pOut)
+{
+  // Pairs of values become 10-bit words, pairs of words 20-bit dwords and pairs of dwords 40-bit qwords,
+  // and the five low bytes of each qword are gathered. Each store writes 16 bytes for 10, so the loop
+  // stops while the overrun still lands inside pOut.
+  const __m256i pairs = _mm256_set1_epi16(0x2001);      // v0 + v1 * 32
+  const __m256i quads = _mm256_set1_epi32(0x04000001);  // w0 + w1 * 1024
+  const __m256i low32 = _mm256_set1_epi64x(0xFFFFFFFF);
+  const __m256i gather = _mm256_setr_epi8(0, 1, 2, 3, 4, 8, 9, 10, 11, 12, -1, -1, -1, -1, -1, -1,
+                                          0, 1, 2, 3, 4, 8, 9, 10, 11, 12, -1, -1, -1, -1, -1, -1);
+  size_t i = 0;
+  for (; i + 48 <= iCount; i += 32, pOut += 20)
+  {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(pValues + i));
+    v = _mm256_madd_epi16(_mm256_maddubs_epi16(v, pairs), quads);
+    v = _mm256_or_si256(_mm256_and_si256(v, low32), _mm256_slli_epi64(_mm256_srli_epi64(v, 32), 20));
+    v = _mm256_shuffle_epi8(v, gather);
+    _mm_storeu_si128((__m128i*)pOut, _mm256_castsi256_si128(v));
+    _mm_storeu_si128((__m128i*)(pOut + 10), _mm256_extracti128_si256(v, 1));
+  }
+  scalarPack(pValues + i, iCount - i, pOut);
+}
+
+__attribute__((target("avx2")))
+static void avx2Unpack(const unsigned char* pIn, size_t iBit, size_t iCount, unsigned char* pValues)
+{
+  // Each 128-bit lane loads 16 bytes covering two groups and shuffles each group's bytes into a qword,
+  // which is then split 40 -> 2 x 20 -> 4 x 10 -> 8 x 5 bits. The loads read 26 bytes for 20.
+  pIn += iBit / 8;
+  iBit %= 8;
+  const __m128i shift = _mm_cvtsi64_si128((long long)iBit);
+  const __m256i spread = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 5, 6, 7, 8, 9, 10, 11, 12,
+                                          0, 1, 2, 3, 4, 5, 6, 7, 5, 6, 7, 8, 9, 10, 11, 12);
+  const __m256i low20 = _mm256_set1_epi64x(0x00000000000FFFFFULL);
+  const __m256i high20 = _mm256_set1_epi64x(0x000FFFFF00000000ULL);
+  const __m256i low10 = _mm256_set1_epi64x(0x000003FF000003FFULL);
+  const __m256i high10 = _mm256_set1_epi64x(0x03FF000003FF0000ULL);
+  const __m256i low5 = _mm256_set1_epi64x(0x001F001F001F001FULL);
+  const __m256i high5 = _mm256_set1_epi64x(0x1F001F001F001F00ULL);
+  size_t i = 0;
+  for (; i + 48 <= iCount; i += 32, pIn += 20)
+  {
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)pIn)),
+                                        _mm_loadu_si128((const __m128i*)(pIn + 10)), 1);
+    v = _mm256_srl_epi64(_mm256_shuffle_epi8(v, spread), shift);
+    v = _mm256_or_si256(_mm256_and_si256(v, low20), _mm256_and_si256(_mm256_slli_epi64(v, 12), high20));
+    v = _mm256_or_si256(_mm256_and_si256(v, low10), _mm256_and_si256(_mm256_slli_epi64(v, 6), high10));
+    v = _mm256_or_si256(_mm256_and_si256(v, low5), _mm256_and_si256(_mm256_slli_epi64(v, 3), high5));
+    _mm256_storeu_si256((__m256i*)(pValues + i), v);
+  }
+  scalarUnpack(pIn, iBit, iCount - i, pValues + i);
+}
+
+#endif
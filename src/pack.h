@@ -0,0 +1,22 @@
+#ifndef PACK_H
+#define PACK_H
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* Number of bytes needed to hold iCount packed 5-bit values */
+#define PACKED_SIZE(iCount) (((iCount) * 5 + 7) / 8)
+
+/* A pack5/unpack5 implementation for one instruction set. Every packer produces exactly the same bits. */
+struct packer_tag
+{
+  const char* pName;
+  bool (*supported)(void); // True if this CPU can run the packer
+  void (*pack)(const unsigned char* pValues, size_t iCount, unsigned char* pOut);
+  void (*unpack)(const unsigned char* pIn, size_t iBit, size_t iCount, unsigned char* pValues);
+};
+typedef struct packer_tag packer_t;
+
+const packer_t* packerList(size_t* pCount);
+void pack5(const unsigned char* pValues, size_t iCount, unsigned char* pOut);
+void unpack5(const unsigned char* pIn, size_t iBit, size_t iCount, unsigned char* pValues);
+#endif
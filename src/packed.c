@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <string.h>
+
+#include "packed.h"
+
+/* Count cut value of each card number: 1-52 are their own number, both Jokers count 53 */
+const unsigned char CUT_VALUE[DECK_SIZE + 1] =
+{
+   0,
+   1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13,
+  14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26,
+  27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39,
+  40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52,
+  53, 53
+};
+
+/* Keystream value of each card number: clubs/hearts are 1-13, diamonds/spades are 14-26, Jokers are 0 (no output) */
+const unsigned char OUT_VALUE[DECK_SIZE + 1] =
+{
+   0,
+   1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13,
+  14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26,
+   1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13,
+  14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26,
+   0,  0
+};
+
+static size_t findCard(packed_t* pPacked, unsigned char iCard);
+static void moveJoker(packed_t* pPacked, unsigned char iJoker, size_t iShift);
+static void packedTripleCut(packed_t* pPacked);
+static void packedCountCut(packed_t* pPacked, size_t iValue);
+
+/* Set pPacked to a standard order deck: 1-54 from top to bottom */
+void standardPacked(packed_t* pPacked)
+{
+  for (size_t i = 0; i < DECK_SIZE; i++)
+    pPacked->cards[i] = (unsigned char)(i + 1);
+}
+
+/* Copy the card order of pDeck into pPacked. pDeck must be a full 54 card deck. */
+void packDeck(deck_t* pDeck, packed_t* pPacked)
+{
+  assert(pDeck->nCards == DECK_SIZE);
+  for (size_t i = 0; i < DECK_SIZE; i++)
+  {
+    card_t* pCard = pDeck->cards[i];
+    if (pCard->value == 53)
+      pPacked->cards[i] = (pCard->suit == CLUBS) ? JOKER_A : JOKER_B;
+    else
+      pPacked->cards[i] = (unsigned char)(pCard->value + 13 * pCard->suit);
+  }
+}
+
+/* Copy the card order of pPacked back into the existing cards of pDeck */
+void unpackDeck(packed_t* pPacked, deck_t* pDeck)
+{
+  assert(pDeck->nCards == DECK_SIZE);
+  for (size_t i = 0; i < DECK_SIZE; i++)
+  {
+    unsigned iCard = pPacked->cards[i];
+    card_t* pCard = pDeck->cards[i];
+    if (iCard >= JOKER_A)
+    {
+      pCard->value = 53;
+      pCard->suit = (iCard == JOKER_A) ? CLUBS : SPADES;
+    }
+    else
+    {
+      pCard->value = (iCard - 1) % 13 + 1;
+      pCard->suit = (suit_t)((iCard - 1) / 13);
+    }
+  }
+}
+
+/* Move the Jokers, triple cut and count cut by the bottom card */
+void packedStep(packed_t* pPacked)
+{
+  moveJoker(pPacked, JOKER_A, 1);
+  moveJoker(pPacked, JOKER_B, 2);
+  packedTripleCut(pPacked);
+  packedCountCut(pPacked, CUT_VALUE[pPacked->cards[DECK_SIZE - 1]]);
+}
+
+/* One key schedule step: a normal step followed by a count cut of iValue (1-53) */
+void packedKeyStep(packed_t* pPacked, size_t iValue)
+{
+  assert(iValue >= 1 && iValue <= 53);
+  packedStep(pPacked);
+  packedCountCut(pPacked, iValue);
+}
+
+/* Return the next keystream value, 1-26. Matches genKeystream() exactly. */
+int packedKeystream(packed_t* pPacked)
+{
+  unsigned iOut = 0;
+  do // Jokers produce no output, so keep stepping until a card is found
+  {
+    packedStep(pPacked);
+    iOut = OUT_VALUE[pPacked->cards[CUT_VALUE[pPacked->cards[0]]]];
+  }
+  while (iOut == 0);
+  return (int)iOut;
+}
+
+/* Fill pOut with the next iLen keystream values */
+void packedKeystreamBlock(packed_t* pPacked, unsigned char* pOut, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+    pOut[i] = (unsigned char)packedKeystream(pPacked);
+}
+
+/* Return the position of iCard */
+static size_t findCard(packed_t* pPacked, unsigned char iCard)
+{
+  const unsigned char* pFound = memchr(pPacked->cards, iCard, DECK_SIZE);
+  assert(pFound != NULL);
+  return (size_t)(pFound - pPacked->cards);
+}
+
+/* Move a Joker down iShift places. Moving past the bottom wraps around to just below the top card.
+   The wraparound and direction are computed without branches. */
+static void moveJoker(packed_t* pPacked, unsigned char iJoker, size_t iShift)
+{
+  size_t iFrom = findCard(pPacked, iJoker);
+  size_t iTo = iFrom + iShift;
+  iTo -= (size_t)(iTo >= DECK_SIZE) * (DECK_SIZE - 1);
+
+  // Moving down shifts the cards in between up by one; wrapping around shifts them down by one
+  size_t bDown = iTo > iFrom;
+  size_t iSrc = bDown ? iFrom + 1 : iTo;
+  size_t iDst = bDown ? iFrom : iTo + 1;
+  size_t iLen = bDown ? iTo - iFrom : iFrom - iTo;
+  memmove(pPacked->cards + iDst, pPacked->cards + iSrc, iLen);
+  pPacked->cards[iTo] = iJoker;
+}
+
+/* Swap the cards above the first Joker with the cards below the second Joker */
+static void packedTripleCut(packed_t* pPacked)
+{
+  size_t iA = findCard(pPacked, JOKER_A);
+  size_t iB = findCard(pPacked, JOKER_B);
+  size_t iFirst = iA < iB ? iA : iB;
+  size_t iSecond = iA ^ iB ^ iFirst;
+
+  unsigned char pTemp[DECK_SIZE];
+  size_t iBottom = DECK_SIZE - 1 - iSecond;
+  memcpy(pTemp, pPacked->cards + iSecond + 1, iBottom);
+  memcpy(pTemp + iBottom, pPacked->cards + iFirst, iSecond - iFirst + 1);
+  memcpy(pTemp + iBottom + iSecond - iFirst + 1, pPacked->cards, iFirst);
+  memcpy(pPacked->cards, pTemp, DECK_SIZE);
+}
+
+/* Cut iValue (1-53) cards from the top and move them above the bottom card.
+   This is a rotation of the top 53 cards, done as a single copy out of a doubled buffer. */
+static void packedCountCut(packed_t* pPacked, size_t iValue)
+{
+  unsigned char pTemp[2 * (DECK_SIZE - 1)];
+  memcpy(pTemp, pPacked->cards, DECK_SIZE - 1);
+  memcpy(pTemp + DECK_SIZE - 1, pPacked->cards, DECK_SIZE - 1);
+  memcpy(pPacked->cards, pTemp + iValue, DECK_SIZE - 1);
+}
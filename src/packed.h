@@ -0,0 +1,28 @@
+#ifndef PACKED_H
+#define PACKED_H
+#include <stdlib.h>
+#include "deck.h"
+
+#define DECK_SIZE 54
+#define JOKER_A 53
+#define JOKER_B 54
+
+/* A deck stored as one byte per card, numbered 1-54 in bridge order (see README).
+   Card 53 is the "A" Joker and card 54 is the "B" Joker. */
+struct packed_tag
+{
+  unsigned char cards[DECK_SIZE];
+};
+typedef struct packed_tag packed_t;
+
+extern const unsigned char CUT_VALUE[DECK_SIZE + 1]; // Count cut value of each card number
+extern const unsigned char OUT_VALUE[DECK_SIZE + 1]; // Keystream value of each card number, 0 for a Joker
+
+void standardPacked(packed_t* pPacked);
+void packDeck(deck_t* pDeck, packed_t* pPacked);
+void unpackDeck(packed_t* pPacked, deck_t* pDeck);
+void packedStep(packed_t* pPacked);
+void packedKeyStep(packed_t* pPacked, size_t iValue);
+int packedKeystream(packed_t* pPacked);
+void packedKeystreamBlock(packed_t* pPacked, unsigned char* pOut, size_t iLen);
+#endif
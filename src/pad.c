@@ -0,0 +1,323 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include "cipher.h"
+#include "file.h"
+#include "pack.h"
+#include "pad.h"
+
+/* Values are generated in blocks of a multiple of 8 so every block packs into whole bytes */
+#define PAD_BLOCK 4096
+
+bool readPad(char* pPadFile, uint64_t* pOffset, uint64_t iFirstUnused, size_t iLen, unsigned char* pValues);
+int lockPadUsage(char* pPadFile, uint64_t* pFirstUnused);
+bool savePadUsage(int fd, uint64_t iFirstUnused);
+static bool writePadHeader(FILE* f, const padHeader_t* pHeader);
+static bool readPadHeader(FILE* f, padHeader_t* pHeader);
+
+/* Precompute iCount keystream values for the deck/key in the first line of pKeyFile and write them to the pad pOutput.
+   The first iOffset values of the keystream are skipped, so a long pad can be generated in segments.
+   If pOutput is NULL, 'pad.bin' is used. */
+bool generatePad(char* pKeyFile, bool isDeck, uint64_t iOffset, uint64_t iCount, char* pOutput)
+{
+  if (pKeyFile == NULL)
+  {
+    fprintf(stderr, "Generating a pad requires a key file.\n");
+    return false;
+  }
+
+  char* pKey = NULL;
+  if (!parseKeyFile(pKeyFile, &pKey))
+    return false;
+
+  deck_t* pDeck = keyToDeck(pKey, isDeck);
+  free(pKey);
+  if (pDeck == NULL)
+    return false;
+
+  if (iCount > UINT64_MAX - iOffset)
+  {
+    fprintf(stderr, "A pad of %" PRIu64 " values from offset %" PRIu64 " runs past the end of the keystream.\n", iCount, iOffset);
+    freeDeck(pDeck);
+    return false;
+  }
+
+  if (pOutput == NULL)
+    pOutput = "pad.bin";
+
+  FILE* f = fopen(pOutput, "wb");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Unable to create pad file '%s': %s\n", pOutput, strerror(errno));
+    freeDeck(pDeck);
+    return false;
+  }
+
+  padHeader_t header = { PAD_MAGIC, iOffset, iCount };
+  bool bOk = writePadHeader(f, &header);
+
+  for (uint64_t i = 0; i < iOffset; i++)
+    genKeystream(pDeck);
+
+  unsigned char pValues[PAD_BLOCK];
+  unsigned char pPacked[PACKED_SIZE(PAD_BLOCK)];
+  for (uint64_t iDone = 0; bOk && iDone < iCount; iDone += PAD_BLOCK)
+  {
+    size_t iBlock = (iCount - iDone < PAD_BLOCK) ? (size_t)(iCount - iDone) : PAD_BLOCK;
+    for (size_t i = 0; i < iBlock; i++)
+      pValues[i] = (unsigned char)(genKeystream(pDeck) - 1);
+
+    pack5(pValues, iBlock, pPacked);
+    bOk = fwrite(pPacked, 1, PACKED_SIZE(iBlock), f) == PACKED_SIZE(iBlock);
+  }
+
+  if (!bOk)
+    fprintf(stderr, "Error writing pad file '%s': %s\n", pOutput, strerror(errno));
+
+  if (fclose(f) != 0)
+  {
+    fprintf(stderr, "Error closing pad file '%s': %s\n", pOutput, strerror(errno));
+    bOk = false;
+  }
+  freeDeck(pDeck);
+  return bOk;
+}
+
+/* Encrypt/decrypt the first line of pInput with keystream read from pPadFile, starting at keystream position iOffset.
+   Any key/deck line in pInput is ignored. The output file summarizes the pad range used and the next unused offset.
+   Encryption records the first unused offset in '<pad>.used' and refuses to use any pad value before it again.
+   If iOffset is PAD_NEXT, encryption starts at that first unused offset and decryption at the start of the pad.
+   If pOutput is NULL, 'output.txt' is used. */
+bool runPad(char* pInput, char* pPadFile, uint64_t iOffset, bool bEncrypt, char* pOutput)
+{
+  char* pRawInput = NULL;
+  char* pRawKey = NULL;
+  if (!parseFile(pInput, &pRawInput, &pRawKey))
+    return false;
+  free(pRawKey);
+
+  cleanInput(pRawInput);
+  size_t iLen = strlen(pRawInput);
+  if (iLen == 0)
+  {
+    fprintf(stderr, "Input text did not contain any alpha characters.\n");
+    free(pRawInput);
+    return false;
+  }
+
+  // The usage file stays locked until the new first unused offset is saved, so two encryptions cannot share values
+  uint64_t iFirstUnused = 0;
+  int fdUsage = -1;
+  if (bEncrypt && (fdUsage = lockPadUsage(pPadFile, &iFirstUnused)) < 0)
+  {
+    free(pRawInput);
+    return false;
+  }
+
+  unsigned char* pValues = malloc(iLen * sizeof(unsigned char));
+  if (!readPad(pPadFile, &iOffset, iFirstUnused, iLen, pValues))
+  {
+    if (fdUsage >= 0)
+      close(fdUsage);
+    free(pRawInput);
+    free(pValues);
+    return false;
+  }
+
+  char* pCipher = malloc((iLen + 1) * sizeof(char));
+  for (size_t i = 0; i < iLen; i++)
+    pCipher[i] = combineChar(bEncrypt, pRawInput[i], pValues[i] + 1);
+  pCipher[iLen] = '\0';
+  free(pValues);
+
+  if (pOutput == NULL)
+    pOutput = "output.txt";
+
+  bool bOk = true;
+  FILE* f = fopen(pOutput, "w");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Unable to create output file '%s': %s\n", pOutput, strerror(errno));
+    bOk = false;
+  }
+  else
+  {
+    fputs(bEncrypt ? "Encrypt Mode\n" : "Decrypt Mode\n", f);
+    fprintf(f, "Cleaned input text: '%s'\n", pRawInput);
+    fprintf(f, "Pad file: '%s'\n", pPadFile);
+    fprintf(f, "Pad offset: '%" PRIu64 "'\n", iOffset);
+    fprintf(f, "Next pad offset: '%" PRIu64 "'\n", iOffset + iLen);
+    fprintf(f, "Output text: '%s'\n", pCipher);
+    if (fclose(f) != 0)
+    {
+      fprintf(stderr, "Error closing output file '%s': %s\n", pOutput, strerror(errno));
+      bOk = false;
+    }
+  }
+
+  if (fdUsage >= 0)
+  {
+    if (bOk && !savePadUsage(fdUsage, iOffset + iLen))
+    {
+      fprintf(stderr, "Error recording the used range of pad file '%s': %s\n", pPadFile, strerror(errno));
+      bOk = false;
+    }
+    close(fdUsage);
+  }
+
+  free(pRawInput);
+  free(pCipher);
+  return bOk;
+}
+
+/* Read iLen keystream values (0-25) from the pad pPadFile starting at keystream position *pOffset.
+   If *pOffset is PAD_NEXT it is set to the first pad value at or after iFirstUnused; otherwise it must not be
+   before iFirstUnused. Only the bytes covering the requested range are read. */
+bool readPad(char* pPadFile, uint64_t* pOffset, uint64_t iFirstUnused, size_t iLen, unsigned char* pValues)
+{
+  if (pPadFile == NULL)
+  {
+    fprintf(stderr, "Pad filename was null.\n");
+    return false;
+  }
+
+  FILE* f = fopen(pPadFile, "rb");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Error opening pad file '%s': %s.\n", pPadFile, strerror(errno));
+    return false;
+  }
+
+  padHeader_t header;
+  bool bOk = readPadHeader(f, &header) && memcmp(header.magic, PAD_MAGIC, sizeof(header.magic)) == 0 &&
+             header.count <= UINT64_MAX - header.offset;
+  if (!bOk)
+    fprintf(stderr, "'%s' is not a pad file.\n", pPadFile);
+
+  uint64_t iEnd = bOk ? header.offset + header.count : 0;
+  if (bOk && *pOffset == PAD_NEXT)
+    *pOffset = iFirstUnused > header.offset ? iFirstUnused : header.offset;
+  uint64_t iOffset = *pOffset;
+  if (bOk && iOffset < iFirstUnused)
+  {
+    fprintf(stderr, "Pad '%s' has already been used up to offset %" PRIu64 "; offset %" PRIu64 " would reuse keystream.\n",
+            pPadFile, iFirstUnused, iOffset);
+    bOk = false;
+  }
+  else if (bOk && (iOffset < header.offset || iOffset > iEnd || iLen > iEnd - iOffset))
+  {
+    fprintf(stderr, "Pad '%s' covers offsets %" PRIu64 " to %" PRIu64 ", but %zu values from offset %" PRIu64 " were requested.\n",
+            pPadFile, header.offset, iEnd, iLen, iOffset);
+    bOk = false;
+  }
+
+  if (bOk)
+  {
+    uint64_t iBit = (iOffset - header.offset) * 5;
+    size_t iBytes = (size_t)((iBit % 8 + iLen * 5 + 7) / 8);
+    unsigned char* pPacked = malloc(iBytes);
+    bOk = fseeko(f, (off_t)(PAD_HEADER_SIZE + iBit / 8), SEEK_SET) == 0 && fread(pPacked, 1, iBytes, f) == iBytes;
+    if (bOk)
+      unpack5(pPacked, iBit % 8, iLen, pValues);
+    else
+      fprintf(stderr, "Error reading pad file '%s'\n", pPadFile);
+    free(pPacked);
+
+    // Only 0-25 are keystream values; anything else means the pad is corrupt
+    for (size_t i = 0; bOk && i < iLen; i++)
+    {
+      if (pValues[i] > 25)
+      {
+        fprintf(stderr, "Pad '%s' holds an invalid value at offset %" PRIu64 ".\n", pPadFile, iOffset + i);
+        bOk = false;
+      }
+    }
+  }
+
+  if (fclose(f) != 0)
+  {
+    fprintf(stderr, "Error closing pad file '%s': %s\n", pPadFile, strerror(errno));
+    return false;
+  }
+  return bOk;
+}
+
+/* Open and lock '<pad>.used', which holds the pad's first unused offset as a decimal number, and read it into
+   *pFirstUnused (0 if the file is new). Returns the locked descriptor, or -1 on error. */
+int lockPadUsage(char* pPadFile, uint64_t* pFirstUnused)
+{
+  if (pPadFile == NULL)
+  {
+    fprintf(stderr, "Pad filename was null.\n");
+    return -1;
+  }
+
+  size_t iPathLen = strlen(pPadFile) + sizeof(".used");
+  char* pPath = malloc(iPathLen);
+  snprintf(pPath, iPathLen, "%s.used", pPadFile);
+  int fd = open(pPath, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0 || flock(fd, LOCK_EX) != 0)
+  {
+    fprintf(stderr, "Unable to open pad usage file '%s': %s.\n", pPath, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+    free(pPath);
+    return -1;
+  }
+
+  char pText[32] = { 0 };
+  ssize_t iRead = pread(fd, pText, sizeof(pText) - 1, 0);
+  char* pEnd = NULL;
+  *pFirstUnused = iRead > 0 ? strtoull(pText, &pEnd, 10) : 0;
+  if (iRead < 0 || (iRead > 0 && (pEnd == pText || (*pEnd != '\n' && *pEnd != '\0'))))
+  {
+    fprintf(stderr, "Pad usage file '%s' is damaged; refusing to guess which pad values are unused.\n", pPath);
+    close(fd);
+    fd = -1;
+  }
+  free(pPath);
+  return fd;
+}
+
+/* Replace the offset in a locked pad usage file */
+bool savePadUsage(int fd, uint64_t iFirstUnused)
+{
+  char pText[32];
+  int iLen = snprintf(pText, sizeof(pText), "%" PRIu64 "\n", iFirstUnused);
+  return ftruncate(fd, 0) == 0 && pwrite(fd, pText, (size_t)iLen, 0) == iLen && fsync(fd) == 0;
+}
+
+/* Write a pad header as its magic, then offset and count little-endian, whatever the host byte order */
+static bool writePadHeader(FILE* f, const padHeader_t* pHeader)
+{
+  unsigned char bytes[PAD_HEADER_SIZE];
+  memcpy(bytes, pHeader->magic, 8);
+  for (size_t i = 0; i < 8; i++)
+  {
+    bytes[8 + i] = (unsigned char)(pHeader->offset >> (8 * i));
+    bytes[16 + i] = (unsigned char)(pHeader->count >> (8 * i));
+  }
+  return fwrite(bytes, 1, sizeof(bytes), f) == sizeof(bytes);
+}
+
+static bool readPadHeader(FILE* f, padHeader_t* pHeader)
+{
+  unsigned char bytes[PAD_HEADER_SIZE];
+  if (fread(bytes, 1, sizeof(bytes), f) != sizeof(bytes))
+    return false;
+  memcpy(pHeader->magic, bytes, 8);
+  pHeader->offset = 0;
+  pHeader->count = 0;
+  for (size_t i = 0; i < 8; i++)
+  {
+    pHeader->offset |= (uint64_t)bytes[8 + i] << (8 * i);
+    pHeader->count |= (uint64_t)bytes[16 + i] << (8 * i);
+  }
+  return true;
+}
@@ -0,0 +1,22 @@
+#ifndef PAD_H
+#define PAD_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PAD_MAGIC "SOLPAD1"
+#define PAD_NEXT UINT64_MAX // Offset passed to runPad() to start at the pad's next unused value
+#define PAD_HEADER_SIZE 24  // magic, then offset and count as little-endian 64-bit integers
+
+/* A pad file is this header, stored in PAD_HEADER_SIZE bytes, followed by PACKED_SIZE(count) bytes of
+   keystream values. Values are stored as (keystream - 1) so they fit in 5 bits. */
+struct padHeader_tag
+{
+  char     magic[8];
+  uint64_t offset; // Keystream position of the first value in the pad
+  uint64_t count;  // Number of keystream values in the pad
+};
+typedef struct padHeader_tag padHeader_t;
+
+bool generatePad(char* pKeyFile, bool isDeck, uint64_t iOffset, uint64_t iCount, char* pOutput);
+bool runPad(char* pInput, char* pPadFile, uint64_t iOffset, bool bEncrypt, char* pOutput);
+#endif
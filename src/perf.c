@@ -0,0 +1,123 @@
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf.h"
+
+/* Open every counter for the calling thread, user space only. Counters that cannot be opened are skipped.
+   The first counter opened leads the group, so the kernel schedules them all onto the PMU together and one
+   read returns every value along with how long the group was enabled and actually running. */
+void perfOpen(perf_t* pPerf)
+{
+  static const struct { uint32_t type; uint64_t config; } EVENTS[NUM_COUNTERS] =
+  {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }
+  };
+
+  memset(pPerf, 0, sizeof(perf_t));
+  pPerf->iLeader = -1;
+  for (size_t i = 0; i < NUM_COUNTERS; i++)
+  {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = EVENTS[i].type;
+    attr.config = EVENTS[i].config;
+    attr.disabled = pPerf->iLeader < 0; // Members follow the leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    pPerf->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, pPerf->iLeader, 0);
+    if (pPerf->fds[i] < 0)
+      continue;
+    if (pPerf->iLeader < 0)
+      pPerf->iLeader = pPerf->fds[i];
+    pPerf->order[pPerf->nGroup++] = (counter_t)i;
+  }
+}
+
+/* True if the counter was opened successfully */
+bool perfAvailable(perf_t* pPerf, counter_t counter)
+{
+  return pPerf->fds[counter] >= 0;
+}
+
+/* True if the counter was opened and the group counted during the last perfStart()/perfStop() window */
+bool perfCounted(perf_t* pPerf, counter_t counter)
+{
+  return perfAvailable(pPerf, counter) && pPerf->dCoverage > 0;
+}
+
+/* Reset and start all counters and the clock */
+void perfStart(perf_t* pPerf)
+{
+  if (pPerf->iLeader >= 0)
+  {
+    ioctl(pPerf->iLeader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(pPerf->iLeader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  pPerf->dStart = perfNow();
+}
+
+/* Stop all counters and the clock and read their values. If the PMU was shared with other events, the group
+   only counted for part of the window, so each value is scaled by time enabled / time running. */
+void perfStop(perf_t* pPerf)
+{
+  pPerf->dSeconds = perfNow() - pPerf->dStart;
+  memset(pPerf->values, 0, sizeof(pPerf->values));
+  pPerf->dCoverage = 0;
+  if (pPerf->iLeader < 0)
+    return;
+
+  ioctl(pPerf->iLeader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  uint64_t pRead[3 + NUM_COUNTERS]; // nr, time enabled, time running, then one value per counter
+  ssize_t iSize = (ssize_t)((3 + pPerf->nGroup) * sizeof(uint64_t));
+  if (read(pPerf->iLeader, pRead, sizeof(pRead)) != iSize || pRead[0] != pPerf->nGroup || pRead[1] == 0 || pRead[2] == 0)
+    return;
+
+  pPerf->dCoverage = (double)pRead[2] / (double)pRead[1];
+  for (size_t i = 0; i < pPerf->nGroup; i++)
+    pPerf->values[pPerf->order[i]] = (uint64_t)((double)pRead[3 + i] / pPerf->dCoverage);
+}
+
+/* Close all counters */
+void perfClose(perf_t* pPerf)
+{
+  for (size_t i = 0; i < NUM_COUNTERS; i++)
+  {
+    if (pPerf->fds[i] >= 0)
+      close(pPerf->fds[i]);
+    pPerf->fds[i] = -1;
+  }
+  pPerf->iLeader = -1;
+}
+
+/* Short column name of a counter */
+const char* perfName(counter_t counter)
+{
+  switch (counter)
+  {
+    case PERF_CYCLES: return "cycles";
+    case PERF_INSTRUCTIONS: return "instr";
+    case PERF_BRANCH_MISSES: return "br-miss";
+    case PERF_L1_MISSES: return "L1-miss";
+    case PERF_PAGE_FAULTS: return "faults";
+    case NUM_COUNTERS: break;
+  }
+  return "?";
+}
+
+/* Current monotonic time in seconds */
+double perfNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
@@ -0,0 +1,40 @@
+#ifndef PERF_H
+#define PERF_H
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_BRANCH_MISSES,
+  PERF_L1_MISSES,
+  PERF_PAGE_FAULTS,
+  NUM_COUNTERS
+} counter_t;
+
+/* A set of perf_event_open counters for the calling thread, opened as one group so they all count over
+   the same window. Any counter the kernel or hardware does not provide has an fd of -1 and is reported as
+   unavailable; wall-clock time is always measured. */
+struct perf_tag
+{
+  int       fds[NUM_COUNTERS];
+  int       iLeader;                // fd of the group leader, -1 if no counter could be opened
+  counter_t order[NUM_COUNTERS];    // Counter of each value in a group read, in the order they joined
+  size_t    nGroup;
+  uint64_t  values[NUM_COUNTERS];   // Scaled up to the whole window if the group was multiplexed
+  double    dCoverage;              // Fraction of the window the group was on the PMU; 0 if it never was
+  double    dStart;
+  double    dSeconds;
+};
+typedef struct perf_tag perf_t;
+
+void perfOpen(perf_t* pPerf);
+bool perfAvailable(perf_t* pPerf, counter_t counter);
+bool perfCounted(perf_t* pPerf, counter_t counter);
+void perfStart(perf_t* pPerf);
+void perfStop(perf_t* pPerf);
+void perfClose(perf_t* pPerf);
+const char* perfName(counter_t counter);
+double perfNow();
+#endif
@@ -0,0 +1,219 @@
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cipher.h"
+#include "file.h"
+#include "pipeline.h"
+#include "ring.h"
+#include "trace.h"
+
+/* Each stage works on whole chunks. Memory use is bounded by nChunks * CHUNK_SIZE. */
+#define CHUNK_SIZE (1 << 20)
+#define NUM_CHUNKS 8
+
+struct chunk_tag
+{
+  char*  pData;
+  size_t iLen;
+  bool   bLast; // Set on the final chunk of the stream (which may be empty)
+};
+typedef struct chunk_tag chunk_t;
+
+struct pipeline_tag
+{
+  FILE*        fIn;
+  FILE*        fOut;
+  ring_t*      pFree;   // Writer -> reader: empty chunks
+  ring_t*      pFilled; // Reader -> cipher: raw chunks
+  ring_t*      pDone;   // Cipher -> writer: ciphered chunks
+  atomic_bool  bFailed;
+};
+typedef struct pipeline_tag pipeline_t;
+
+void* readStage(void* pArg);
+void* writeStage(void* pArg);
+
+/* Stream the whole of pInput through the cipher using three threads.
+   The reader thread fills chunks from pInput, the calling thread cleans and ciphers them and the
+   writer thread flushes them to pOutput. The stages are joined by single-producer/single-consumer rings.
+   The deck/key is read from the first line of pKeyFile; isDeck selects between a deck order and key text.
+   Only the cleaned output text is written. If bBinary is set, the input is not cleaned and every byte is
+   ciphered mod 256 instead. If pOutput is NULL, 'output.txt' is used. */
+bool runPipeline(char* pInput, char* pKeyFile, bool bEncrypt, bool isDeck, bool bBinary, char* pOutput)
+{
+  if (pKeyFile == NULL)
+  {
+    fprintf(stderr, "Pipeline mode requires a key file.\n");
+    return false;
+  }
+
+  char* pKey = NULL;
+  if (!parseKeyFile(pKeyFile, &pKey))
+    return false;
+
+  deck_t* pDeck = keyToDeck(pKey, isDeck);
+  free(pKey);
+  if (pDeck == NULL)
+    return false;
+
+  packed_t packed;
+  packDeck(pDeck, &packed);
+  freeDeck(pDeck);
+
+  if (pOutput == NULL)
+    pOutput = "output.txt";
+
+  pipeline_t pipe;
+  pipe.fIn = fopen(pInput, "rb");
+  if (pipe.fIn == NULL)
+  {
+    fprintf(stderr, "Error opening file '%s': %s.\n", pInput, strerror(errno));
+    return false;
+  }
+  pipe.fOut = fopen(pOutput, "wb");
+  if (pipe.fOut == NULL)
+  {
+    fprintf(stderr, "Unable to create output file '%s': %s\n", pOutput, strerror(errno));
+    fclose(pipe.fIn);
+    return false;
+  }
+
+  pipe.pFree = makeRing(NUM_CHUNKS);
+  pipe.pFilled = makeRing(NUM_CHUNKS);
+  pipe.pDone = makeRing(NUM_CHUNKS);
+  atomic_init(&pipe.bFailed, false);
+
+  chunk_t pChunks[NUM_CHUNKS];
+  for (size_t i = 0; i < NUM_CHUNKS; i++)
+  {
+    pChunks[i].pData = malloc(CHUNK_SIZE * sizeof(char));
+    pChunks[i].iLen = 0;
+    pChunks[i].bLast = false;
+    ringPushWait(pipe.pFree, &pChunks[i]);
+  }
+
+  // If the writer cannot be started the reader is told to stop, and the chunks it has already
+  // filled are handed straight back to it until it sends its last one
+  pthread_t reader;
+  pthread_t writer;
+  bool bReader = pthread_create(&reader, NULL, readStage, &pipe) == 0;
+  bool bWriter = bReader && pthread_create(&writer, NULL, writeStage, &pipe) == 0;
+  if (!bWriter)
+  {
+    fprintf(stderr, "Unable to start the pipeline threads.\n");
+    atomic_store(&pipe.bFailed, true);
+  }
+
+  // Cipher stage: clean each raw chunk in place (text only) then cipher it in place
+  traceThreadName("cipher");
+  bool bLast = !bReader;
+  while (!bLast)
+  {
+    traceBegin("wait");
+    chunk_t* pChunk = ringPopWait(pipe.pFilled);
+    traceEnd("wait");
+    bLast = pChunk->bLast;
+    if (!bWriter)
+    {
+      if (!bLast)
+        ringPushWait(pipe.pFree, pChunk);
+      continue;
+    }
+    if (bBinary)
+    {
+      traceBegin("keystream");
+      cipherBytes(bEncrypt, &packed, (unsigned char*)pChunk->pData, (unsigned char*)pChunk->pData, pChunk->iLen);
+      traceEnd("keystream");
+    }
+    else
+    {
+      traceBegin("clean");
+      pChunk->iLen = cleanBuffer(pChunk->pData, pChunk->iLen);
+      traceEnd("clean");
+      traceBegin("keystream");
+      cipherPacked(bEncrypt, &packed, pChunk->pData, pChunk->pData, pChunk->iLen);
+      traceEnd("keystream");
+    }
+    ringPushWait(pipe.pDone, pChunk);
+  }
+
+  if (bReader)
+    pthread_join(reader, NULL);
+  if (bWriter)
+    pthread_join(writer, NULL);
+
+  bool bOk = !atomic_load(&pipe.bFailed);
+  if (fclose(pipe.fIn) != 0)
+    bOk = false;
+  if (fclose(pipe.fOut) != 0)
+  {
+    fprintf(stderr, "Error closing output file '%s': %s\n", pOutput, strerror(errno));
+    bOk = false;
+  }
+
+  for (size_t i = 0; i < NUM_CHUNKS; i++)
+    free(pChunks[i].pData);
+  freeRing(pipe.pFree);
+  freeRing(pipe.pFilled);
+  freeRing(pipe.pDone);
+  return bOk;
+}
+
+/* Reader stage: fill free chunks from the input file until EOF or an error */
+void* readStage(void* pArg)
+{
+  pipeline_t* pPipe = pArg;
+  traceThreadName("reader");
+  bool bLast = false;
+  while (!bLast)
+  {
+    traceBegin("wait");
+    chunk_t* pChunk = ringPopWait(pPipe->pFree);
+    traceEnd("wait");
+    traceBegin("read");
+    pChunk->iLen = atomic_load(&pPipe->bFailed) ? 0 : fread(pChunk->pData, sizeof(char), CHUNK_SIZE, pPipe->fIn);
+    traceEnd("read");
+    if (pChunk->iLen < CHUNK_SIZE)
+    {
+      if (ferror(pPipe->fIn))
+      {
+        fprintf(stderr, "Error reading input file: %s\n", strerror(errno));
+        atomic_store(&pPipe->bFailed, true);
+      }
+      bLast = true;
+    }
+    pChunk->bLast = bLast;
+    ringPushWait(pPipe->pFilled, pChunk);
+  }
+  return NULL;
+}
+
+/* Writer stage: flush ciphered chunks to the output file and recycle them */
+void* writeStage(void* pArg)
+{
+  pipeline_t* pPipe = pArg;
+  traceThreadName("writer");
+  bool bLast = false;
+  while (!bLast)
+  {
+    traceBegin("wait");
+    chunk_t* pChunk = ringPopWait(pPipe->pDone);
+    traceEnd("wait");
+    bLast = pChunk->bLast;
+    traceBegin("write");
+    size_t iWritten = fwrite(pChunk->pData, sizeof(char), pChunk->iLen, pPipe->fOut);
+    traceEnd("write");
+    if (iWritten != pChunk->iLen)
+    {
+      fprintf(stderr, "Error writing output file: %s\n", strerror(errno));
+      atomic_store(&pPipe->bFailed, true);
+    }
+    if (!bLast)
+      ringPushWait(pPipe->pFree, pChunk);
+  }
+  return NULL;
+}
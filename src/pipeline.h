@@ -0,0 +1,6 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+#include <stdbool.h>
+
+bool runPipeline(char* pInput, char* pKeyFile, bool bEncrypt, bool isDeck, bool bBinary, char* pOutput);
+#endif
@@ -0,0 +1,226 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "reference.h"
+
+/* A frozen copy of the original card-by-card deck and keystream code.
+   It is the oracle for the conformance checks and must not be changed or optimized. */
+
+/* Move a card in a deck from a position, to another position */
+void refMoveCard(deck_t* pDeck, size_t iFrom, size_t iTo)
+{
+  assert(pDeck->nCards > iFrom && pDeck->nCards > iTo);
+  card_t* pC = pDeck->cards[iFrom];
+  if (iTo < iFrom)
+  {
+    for (size_t i = iFrom; i > iTo; i--)
+      pDeck->cards[i] = pDeck->cards[i-1];
+  }
+  else
+  {
+    for (size_t i = iFrom; i < iTo; i++)
+      pDeck->cards[i] = pDeck->cards[i+1];
+  }
+  pDeck->cards[iTo] = pC;
+}
+
+/* Move the "A" and "B" jokers */
+void refMoveJokers(deck_t* pDeck)
+{
+  // Find the "A" joker (53 of Clubs)
+  card_t* pA = NULL;
+  size_t iPos = 0;
+  for(size_t i = 0; i < pDeck->nCards; i++)
+  {
+    if (pDeck->cards[i]->value == 53 && pDeck->cards[i]->suit == CLUBS)
+    {
+      pA = pDeck->cards[i];
+      iPos = i;
+      break;
+    }
+  }
+
+  if (pA == NULL)
+  {
+    fprintf(stderr, "Unable to find 'A' Joker.\n");
+    assert(false);
+  }
+
+  // Shift "A" Joker down one card.
+  size_t iTo = iPos + 1;
+  if (iTo >= pDeck->nCards) // Wrap around back to the start
+    iTo = iTo - pDeck->nCards + 1;
+
+  refMoveCard(pDeck, iPos, iTo);
+
+  // Find the "B" joker (53 of Spades)
+  card_t* pB = NULL;
+  for(size_t i = 0; i < pDeck->nCards; i++)
+  {
+    if (pDeck->cards[i]->value == 53 && pDeck->cards[i]->suit == SPADES)
+    {
+      pB = pDeck->cards[i];
+      iPos = i;
+      break;
+    }
+  }
+
+  if (pB == NULL)
+  {
+    fprintf(stderr, "Unable to find 'B' Joker.\n");
+    assert(false);
+  }
+
+  // Shift "B" Joker down two cards
+  iTo = iPos + 2;
+  if (iTo >= pDeck->nCards)
+    iTo = iTo - pDeck->nCards + 1;
+
+  refMoveCard(pDeck, iPos, iTo);
+}
+
+/* Triple cut: Swap all cards before the first joker with all cards after the second joker */
+void refTripleCut(deck_t* pDeck)
+{
+  // Copy all cards into a temp deck, grabbing the joker positions
+  card_t** pTempDeck = malloc(pDeck->nCards * sizeof(card_t*));
+  size_t iJoker1 = pDeck->nCards + 1;
+  size_t iJoker2 = pDeck->nCards + 1;
+  for(size_t i = 0; i < pDeck->nCards; i++)
+  {
+    pTempDeck[i] = pDeck->cards[i];
+    if (pTempDeck[i]->value == 53)
+    {
+      if (iJoker1 > pDeck->nCards)
+        iJoker1 = i;
+      else
+        iJoker2 = i;
+    }
+  }
+
+  // Move the cards after the second joker to the front
+  size_t idx = 0;
+  for (size_t i = iJoker2 + 1; i < pDeck->nCards; i++)
+  {
+    pDeck->cards[idx] = pTempDeck[i];
+    idx++;
+  }
+  // Move the cards between both jokers, inclusive
+  for (size_t i = iJoker1; i <= iJoker2; i++)
+  {
+    pDeck->cards[idx] = pTempDeck[i];
+    idx++;
+  }
+  // Move the cards before the first joker
+  for (size_t i = 0; i < iJoker1; i++)
+  {
+    pDeck->cards[idx] = pTempDeck[i];
+    idx++;
+  }
+  free(pTempDeck);
+}
+
+/* Using the bottom card as a reference, cut the deck and move to the bottom leaving the bottom card intact. */
+void refCountCutBottom(deck_t* pDeck)
+{
+  // If the bottom card is a joker, do nothing
+  card_t* pBottom = pDeck->cards[(pDeck->nCards - 1)];
+  if (pBottom->value == 53)
+    return;
+  
+  // Otherwise get the card value from 1 to 53
+  size_t iValue = pBottom->value;
+  switch(pBottom->suit)
+  {
+    case CLUBS: break;
+    case DIAMONDS: iValue += 13; break;
+    case HEARTS: iValue += 26; break;
+    case SPADES: iValue += 39; break;
+    case NUM_SUITS: assert(false); break;
+  }
+
+  refCountCutValue(pDeck, iValue);
+}
+
+/* Using the input number as a reference, cut the deck and move to the bottom leaving the bottom card intact. */
+void refCountCutValue(deck_t* pDeck, size_t iValue)
+{
+  // Move the cards into a temp array
+  card_t** pTempDeck = malloc(pDeck->nCards * sizeof(card_t*));
+  for (size_t i = 0; i < pDeck->nCards; i++)
+    pTempDeck[i] = pDeck->cards[i];
+
+  // Move all cards below to the top (except the bottom)
+  size_t idx = 0;
+  for (size_t i = iValue; i < pDeck->nCards - 1; i++)
+  {
+    pDeck->cards[idx] = pTempDeck[i];
+    idx++;
+  }
+  // ...and move all cards on top to the bottom
+  for (size_t i = 0; i < iValue; i++)
+  {
+    pDeck->cards[idx] = pTempDeck[i];
+    idx++;
+  }
+  pDeck->cards[idx] = pTempDeck[idx];
+  free(pTempDeck);
+}
+
+/* Given a deck of cards, return the next value for encryption.
+   The method is:
+   1. Move "A" and "B" Jokers
+   2. Perform triple cut
+   3. Perform count cut
+   4. Find output card and return its value */
+int refGenKeystream(deck_t* pDeck)
+{
+  refMoveJokers(pDeck);
+  refTripleCut(pDeck);
+  refCountCutBottom(pDeck);
+
+  // Finally, get the output card
+  // Read the Nth card from the top based on the top card value
+  card_t* pTop = pDeck->cards[0];
+  size_t iValue = pTop->value;
+  if (iValue != 53)
+  {
+    switch(pTop->suit)
+    {
+      case CLUBS: break;
+      case DIAMONDS: iValue += 13; break;
+      case HEARTS: iValue += 26; break;
+      case SPADES: iValue += 39; break;
+      case NUM_SUITS: assert(false); break;
+    }
+  }
+
+  card_t* pOutput = pDeck->cards[iValue];
+  iValue = pOutput->value;
+  if (iValue == 53) // Jokers are ignored. Get the next keystream value
+    return refGenKeystream(pDeck);
+
+  // Return the value, 1-26
+  switch(pOutput->suit)
+  {
+    case CLUBS: break;
+    case DIAMONDS: iValue += 13; break;
+    case HEARTS: break;
+    case SPADES: iValue += 13; break;
+    case NUM_SUITS: assert(false); break;
+  }
+  return (int)iValue;
+}
+
+/* The original key schedule: a keystream step without output followed by a count cut of each key value */
+void refKeySchedule(deck_t* pDeck, int* pList, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+  {
+    refMoveJokers(pDeck);
+    refTripleCut(pDeck);
+    refCountCutBottom(pDeck);
+    refCountCutValue(pDeck, pList[i]);
+  }
+}
@@ -0,0 +1,12 @@
+#ifndef REFERENCE_H
+#define REFERENCE_H
+#include "deck.h"
+
+void refMoveCard(deck_t* pDeck, size_t iFrom, size_t iTo);
+void refMoveJokers(deck_t* pDeck);
+void refTripleCut(deck_t* pDeck);
+void refCountCutBottom(deck_t* pDeck);
+void refCountCutValue(deck_t* pDeck, size_t iValue);
+int refGenKeystream(deck_t* pDeck);
+void refKeySchedule(deck_t* pDeck, int* pList, size_t iLen);
+#endif
@@ -0,0 +1,73 @@
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#include "ring.h"
+
+/* Allocate a ring that can hold at least nSlots items. The slot count is rounded up to a power of two. */
+ring_t* makeRing(size_t nSlots)
+{
+  size_t iSize = 1;
+  while (iSize < nSlots)
+    iSize <<= 1;
+
+  ring_t* pRing = aligned_alloc(64, sizeof(ring_t));
+  pRing->slots = malloc(iSize * sizeof(void*));
+  pRing->nSlots = iSize;
+  atomic_init(&pRing->head, 0);
+  atomic_init(&pRing->tail, 0);
+  return pRing;
+}
+
+/* Push pItem onto the ring. Returns false if the ring is full. Producer thread only. */
+bool ringPush(ring_t* pRing, void* pItem)
+{
+  size_t iTail = atomic_load_explicit(&pRing->tail, memory_order_relaxed);
+  size_t iHead = atomic_load_explicit(&pRing->head, memory_order_acquire);
+  if (iTail - iHead == pRing->nSlots)
+    return false;
+
+  pRing->slots[iTail & (pRing->nSlots - 1)] = pItem;
+  atomic_store_explicit(&pRing->tail, iTail + 1, memory_order_release);
+  return true;
+}
+
+/* Pop the oldest item off the ring. Returns NULL if the ring is empty. Consumer thread only. */
+void* ringPop(ring_t* pRing)
+{
+  size_t iHead = atomic_load_explicit(&pRing->head, memory_order_relaxed);
+  size_t iTail = atomic_load_explicit(&pRing->tail, memory_order_acquire);
+  if (iHead == iTail)
+    return NULL;
+
+  void* pItem = pRing->slots[iHead & (pRing->nSlots - 1)];
+  atomic_store_explicit(&pRing->head, iHead + 1, memory_order_release);
+  return pItem;
+}
+
+/* Push pItem, yielding the CPU until there is room */
+void ringPushWait(ring_t* pRing, void* pItem)
+{
+  assert(pItem != NULL);
+  while (!ringPush(pRing, pItem))
+    sched_yield();
+}
+
+/* Pop an item, yielding the CPU until one is available */
+void* ringPopWait(ring_t* pRing)
+{
+  void* pItem = NULL;
+  while ((pItem = ringPop(pRing)) == NULL)
+    sched_yield();
+  return pItem;
+}
+
+/* Free a ring. Any items still in the ring are not freed. */
+void freeRing(ring_t* pRing)
+{
+  if (pRing != NULL)
+  {
+    free(pRing->slots);
+    free(pRing);
+  }
+}
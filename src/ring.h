@@ -0,0 +1,24 @@
+#ifndef RING_H
+#define RING_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* Bounded, lock-free single-producer/single-consumer ring of pointers.
+   Exactly one thread may push and exactly one thread may pop. */
+struct ring_tag
+{
+  void**                 slots;
+  size_t                 nSlots; // Always a power of two
+  _Alignas(64) _Atomic size_t head; // Next slot to pop, owned by the consumer
+  _Alignas(64) _Atomic size_t tail; // Next slot to push, owned by the producer
+};
+typedef struct ring_tag ring_t;
+
+ring_t* makeRing(size_t nSlots);
+bool ringPush(ring_t* pRing, void* pItem);
+void* ringPop(ring_t* pRing);
+void ringPushWait(ring_t* pRing, void* pItem);
+void* ringPopWait(ring_t* pRing);
+void freeRing(ring_t* pRing);
+#endif
@@ -0,0 +1,273 @@
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "schedule.h"
+#include "trace.h"
+
+#define SCHEDULE_CHUNK (1 << 16)      // Bytes of key read at a time
+#define SCHEDULE_CHECKPOINT (1 << 24) // Bytes of key between saved states
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static volatile sig_atomic_t gInterrupted = 0;
+
+static void onInterrupt(int iSignal);
+static uint64_t hashBytes(uint64_t iHash, const char* pBytes, size_t iLen);
+static bool loadState(const char* pStateFile, scheduleState_t* pState);
+static bool saveState(const char* pStateFile, scheduleState_t* pState);
+
+/* Run the key schedule over every letter of pKeyFile ('-' for stdin), reading it in fixed-size chunks so any
+   length of key uses constant memory. Non-letters are skipped, as in key text. If pStateFile is given, the
+   partial schedule is saved there periodically and on SIGINT/SIGTERM, an existing state is resumed from
+   where it stopped, and the state is deleted once the schedule completes. A state is only resumed if the key
+   has the size it was saved with and starts with the same bytes. Returns false if the key could not be read,
+   held no letters, did not match the state or the schedule was interrupted. */
+bool streamKeySchedule(const char* pKeyFile, const char* pStateFile, packed_t* pPacked)
+{
+  bool bStdin = strcmp(pKeyFile, "-") == 0;
+  FILE* f = bStdin ? stdin : fopen(pKeyFile, "rb");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Error opening key file '%s': %s.\n", pKeyFile, strerror(errno));
+    return false;
+  }
+
+  uint64_t iKeySize = SCHEDULE_STDIN;
+  struct stat st;
+  if (!bStdin)
+  {
+    if (fstat(fileno(f), &st) != 0)
+    {
+      fprintf(stderr, "Error reading key file '%s': %s.\n", pKeyFile, strerror(errno));
+      fclose(f);
+      return false;
+    }
+    iKeySize = (uint64_t)st.st_size;
+  }
+
+  scheduleState_t state;
+  memcpy(state.magic, SCHEDULE_MAGIC, sizeof(state.magic));
+  state.nChars = 0;
+  state.iOffset = 0;
+  state.iKeySize = iKeySize;
+  state.iPrefixHash = FNV_OFFSET;
+  standardPacked(pPacked);
+  bool bOk = pStateFile == NULL || loadState(pStateFile, &state);
+  if (bOk && state.iKeySize != iKeySize)
+  {
+    fprintf(stderr, "Key schedule state '%s' was saved for a different key: %s.\n", pStateFile,
+            iKeySize == SCHEDULE_STDIN || state.iKeySize == SCHEDULE_STDIN ? "one is stdin and the other a file" : "the size differs");
+    bOk = false;
+  }
+  if (bOk && state.iOffset > iKeySize)
+  {
+    fprintf(stderr, "Key file '%s' is shorter than the saved key schedule.\n", pKeyFile);
+    bOk = false;
+  }
+  if (!bOk)
+  {
+    if (!bStdin)
+      fclose(f);
+    return false;
+  }
+
+  // Re-read the key already applied to check it matches the state; stdin cannot seek, so it is read either way
+  char* pChunk = malloc(SCHEDULE_CHUNK);
+  uint64_t iHash = FNV_OFFSET;
+  for (uint64_t iSkipped = 0; bOk && iSkipped < state.iOffset; )
+  {
+    size_t iWant = state.iOffset - iSkipped < SCHEDULE_CHUNK ? (size_t)(state.iOffset - iSkipped) : SCHEDULE_CHUNK;
+    size_t iRead = fread(pChunk, 1, iWant, f);
+    iHash = hashBytes(iHash, pChunk, iRead);
+    iSkipped += iRead;
+    bOk = iRead == iWant;
+  }
+  if (!bOk)
+    fprintf(stderr, "Key file '%s' is shorter than the saved key schedule.\n", pKeyFile);
+  else if (iHash != state.iPrefixHash)
+  {
+    fprintf(stderr, "Key schedule state '%s' was saved for a different key: the key text differs.\n", pStateFile);
+    bOk = false;
+  }
+  else if (state.iOffset > 0)
+  {
+    memcpy(pPacked->cards, state.cards, DECK_SIZE);
+    fprintf(stderr, "Resuming key schedule after %llu letters (%llu bytes).\n",
+            (unsigned long long)state.nChars, (unsigned long long)state.iOffset);
+  }
+
+  struct sigaction action;
+  struct sigaction oldInt;
+  struct sigaction oldTerm;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onInterrupt;
+  sigemptyset(&action.sa_mask);
+  gInterrupted = 0;
+  sigaction(SIGINT, &action, &oldInt);
+  sigaction(SIGTERM, &action, &oldTerm);
+
+  traceBegin("key schedule");
+  uint64_t iSaved = state.iOffset;
+  while (bOk)
+  {
+    size_t iRead = fread(pChunk, 1, SCHEDULE_CHUNK, f);
+    for (size_t i = 0; i < iRead; i++)
+    {
+      if (isalpha((unsigned char)pChunk[i]))
+      {
+        packedKeyStep(pPacked, (size_t)(toupper((unsigned char)pChunk[i]) - 'A' + 1));
+        state.nChars++;
+      }
+    }
+    state.iOffset += iRead;
+    state.iPrefixHash = hashBytes(state.iPrefixHash, pChunk, iRead);
+
+    if (iRead < SCHEDULE_CHUNK && ferror(f))
+    {
+      fprintf(stderr, "Error reading key file '%s': %s.\n", pKeyFile, strerror(errno));
+      bOk = false;
+    }
+    bool bDone = iRead < SCHEDULE_CHUNK;
+    bool bComplete = bDone && bOk; // A complete schedule deletes its state below instead of saving it
+    if (pStateFile != NULL && !bComplete && (bDone || gInterrupted || state.iOffset - iSaved >= SCHEDULE_CHECKPOINT))
+    {
+      memcpy(state.cards, pPacked->cards, DECK_SIZE);
+      if (!saveState(pStateFile, &state))
+        bOk = false;
+      iSaved = state.iOffset;
+    }
+    if (gInterrupted && !bComplete)
+    {
+      fprintf(stderr, "Key schedule interrupted after %llu letters (%llu bytes)%s.\n", (unsigned long long)state.nChars,
+              (unsigned long long)state.iOffset, pStateFile != NULL ? "; run again to resume" : "");
+      bOk = false;
+    }
+    if (bDone)
+      break;
+  }
+  traceEnd("key schedule");
+
+  sigaction(SIGINT, &oldInt, NULL);
+  sigaction(SIGTERM, &oldTerm, NULL);
+  free(pChunk);
+  if (!bStdin)
+    fclose(f);
+
+  if (bOk && pStateFile != NULL && remove(pStateFile) != 0 && errno != ENOENT)
+  {
+    fprintf(stderr, "Error removing key schedule state '%s': %s.\n", pStateFile, strerror(errno));
+    bOk = false;
+  }
+  if (bOk && state.nChars == 0)
+  {
+    fprintf(stderr, "Key file '%s' held no alphabetical characters.\n", pKeyFile);
+    bOk = false;
+  }
+  return bOk;
+}
+
+/* Stream the key schedule of pKeyFile (see streamKeySchedule()) and write the resulting deck order to pOutput
+   as one line of card numbers, so it can be used as a deck key file with -K. If pOutput is NULL, 'deck.txt' is used. */
+bool runKeySchedule(const char* pKeyFile, const char* pStateFile, char* pOutput)
+{
+  packed_t packed;
+  if (!streamKeySchedule(pKeyFile, pStateFile, &packed))
+    return false;
+
+  if (pOutput == NULL)
+    pOutput = "deck.txt";
+
+  FILE* f = fopen(pOutput, "w");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Unable to create output file '%s': %s\n", pOutput, strerror(errno));
+    return false;
+  }
+
+  // Card numbers in the deck order format (see README)
+  for (size_t i = 0; i < DECK_SIZE; i++)
+    fprintf(f, "%u%c", packed.cards[i], i == DECK_SIZE - 1 ? '\n' : ' ');
+
+  if (fclose(f) != 0)
+  {
+    fprintf(stderr, "Error closing output file '%s': %s\n", pOutput, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static void onInterrupt(int iSignal)
+{
+  (void)iSignal;
+  gInterrupted = 1;
+}
+
+/* Continue the FNV-1a hash iHash over iLen bytes */
+static uint64_t hashBytes(uint64_t iHash, const char* pBytes, size_t iLen)
+{
+  for (size_t i = 0; i < iLen; i++)
+    iHash = (iHash ^ (unsigned char)pBytes[i]) * FNV_PRIME;
+  return iHash;
+}
+
+/* Read a saved state from pStateFile into pState. A missing file leaves pState as it is.
+   The deck must hold each card exactly once, and no more letters than bytes can have been read. */
+static bool loadState(const char* pStateFile, scheduleState_t* pState)
+{
+  FILE* f = fopen(pStateFile, "rb");
+  if (f == NULL)
+  {
+    if (errno == ENOENT)
+      return true;
+    fprintf(stderr, "Error opening key schedule state '%s': %s.\n", pStateFile, strerror(errno));
+    return false;
+  }
+
+  scheduleState_t saved;
+  bool bOk = fread(&saved, sizeof(saved), 1, f) == 1 && memcmp(saved.magic, SCHEDULE_MAGIC, sizeof(saved.magic)) == 0 &&
+             saved.nChars <= saved.iOffset;
+  fclose(f);
+  bool seen[DECK_SIZE + 1] = { false };
+  for (size_t i = 0; bOk && i < DECK_SIZE; i++)
+  {
+    unsigned iCard = saved.cards[i];
+    bOk = iCard >= 1 && iCard <= DECK_SIZE && !seen[iCard];
+    if (bOk)
+      seen[iCard] = true;
+  }
+  if (!bOk)
+  {
+    fprintf(stderr, "'%s' is not a key schedule state.\n", pStateFile);
+    return false;
+  }
+  *pState = saved;
+  return true;
+}
+
+/* Write pState to pStateFile. The state is written to a temporary file and renamed over the old one,
+   so an interruption never leaves a partly written state. */
+static bool saveState(const char* pStateFile, scheduleState_t* pState)
+{
+  size_t iLen = strlen(pStateFile) + 5;
+  char* pTemp = malloc(iLen);
+  snprintf(pTemp, iLen, "%s.tmp", pStateFile);
+
+  FILE* f = fopen(pTemp, "wb");
+  bool bOk = f != NULL;
+  if (bOk)
+  {
+    bOk = fwrite(pState, sizeof(*pState), 1, f) == 1;
+    bOk = (fclose(f) == 0) && bOk;
+  }
+  if (bOk)
+    bOk = rename(pTemp, pStateFile) == 0;
+  if (!bOk)
+    fprintf(stderr, "Error saving key schedule state '%s': %s.\n", pStateFile, strerror(errno));
+
+  free(pTemp);
+  return bOk;
+}
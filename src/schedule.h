@@ -0,0 +1,27 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "packed.h"
+
+#define SCHEDULE_MAGIC "SOLKEY2"
+#define SCHEDULE_STDIN UINT64_MAX // Key size recorded for a key read from stdin, whose size is unknown
+
+/* A saved partial key schedule: the deck after the first nChars key letters,
+   which were read from the first iOffset bytes of the key input. The key's size and a hash
+   of those bytes tie the state to the key it was made from. */
+struct scheduleState_tag
+{
+  char          magic[8];
+  uint64_t      nChars;
+  uint64_t      iOffset;
+  uint64_t      iKeySize;    // Size of the key file, or SCHEDULE_STDIN
+  uint64_t      iPrefixHash; // FNV-1a of the first iOffset bytes
+  unsigned char cards[DECK_SIZE];
+};
+typedef struct scheduleState_tag scheduleState_t;
+
+bool streamKeySchedule(const char* pKeyFile, const char* pStateFile, packed_t* pPacked);
+bool runKeySchedule(const char* pKeyFile, const char* pStateFile, char* pOutput);
+#endif
@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cipher.h"
+#include "session.h"
+
+_Static_assert(sizeof(packed_t) == DECK_SIZE, "session records must be exactly one byte per card");
+
+void* mapSlab(int fd, size_t iSize, bool bHuge);
+static bool isDeck(const packed_t* pPacked);
+
+/* Open the session slab pFile, creating it with room for nSessions if it does not exist or is empty.
+   An existing file keeps its own session count and all of its decks; any other non-empty file is rejected
+   rather than overwritten, as is a slab shorter than its header says. The file is locked for as long as
+   the store is open, so a second process opening it fails rather than sharing the records unguarded.
+   If pFile is NULL the slab is anonymous and lives only as long as the process.
+   Set bHuge to back the slab with huge pages where the system allows it.
+   Returns NULL on failure. */
+sessionStore_t* openSessionStore(const char* pFile, uint64_t nSessions, bool bHuge)
+{
+  int fd = -1;
+  bool bNew = true;
+  if (pFile != NULL)
+  {
+    fd = open(pFile, O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+    {
+      fprintf(stderr, "Error opening session store '%s': %s.\n", pFile, strerror(errno));
+      return NULL;
+    }
+
+    // The stripe locks only guard this process's threads
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+      if (errno == EWOULDBLOCK)
+        fprintf(stderr, "Session store '%s' is already in use by another process.\n", pFile);
+      else
+        fprintf(stderr, "Error locking session store '%s': %s.\n", pFile, strerror(errno));
+      close(fd);
+      return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+      fprintf(stderr, "Error reading session store '%s': %s.\n", pFile, strerror(errno));
+      close(fd);
+      return NULL;
+    }
+
+    // An existing slab decides its own size, and must be long enough for every record it claims
+    bNew = st.st_size == 0;
+    if (!bNew)
+    {
+      sessionHeader_t header;
+      if (st.st_size < SESSION_HEADER_SIZE || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+          memcmp(header.magic, SESSION_MAGIC, sizeof(header.magic)) != 0 || header.iRecordSize != sizeof(packed_t))
+      {
+        fprintf(stderr, "'%s' is not a session store.\n", pFile);
+        close(fd);
+        return NULL;
+      }
+      if (header.nSessions > (uint64_t)(st.st_size - SESSION_HEADER_SIZE) / sizeof(packed_t))
+      {
+        fprintf(stderr, "Session store '%s' is truncated: it holds %lu sessions but is only %lld bytes.\n",
+                pFile, (unsigned long)header.nSessions, (long long)st.st_size);
+        close(fd);
+        return NULL;
+      }
+      nSessions = header.nSessions;
+    }
+  }
+
+  if (nSessions == 0 || nSessions > (SIZE_MAX - SESSION_HEADER_SIZE) / sizeof(packed_t))
+  {
+    fprintf(stderr, "A session store needs between 1 and %zu sessions.\n", (SIZE_MAX - SESSION_HEADER_SIZE) / sizeof(packed_t));
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+
+  size_t iMapSize = SESSION_HEADER_SIZE + nSessions * sizeof(packed_t);
+  if (fd >= 0 && bNew && ftruncate(fd, (off_t)iMapSize) != 0)
+  {
+    fprintf(stderr, "Error sizing session store '%s': %s.\n", pFile, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  unsigned char* pBase = mapSlab(fd, iMapSize, bHuge);
+  if (pBase == NULL)
+  {
+    if (fd >= 0)
+      close(fd);
+    return NULL;
+  }
+
+  sessionStore_t* pStore = malloc(sizeof(sessionStore_t));
+  pStore->iFd = fd;
+  pStore->pBase = pBase;
+  pStore->iMapSize = iMapSize;
+  pStore->pRecords = (packed_t*)(pBase + SESSION_HEADER_SIZE);
+  pStore->nSessions = nSessions;
+  for (size_t i = 0; i < SESSION_STRIPES; i++)
+    pthread_mutex_init(&pStore->locks[i], NULL);
+
+  if (bNew)
+  {
+    sessionHeader_t* pHeader = (sessionHeader_t*)pBase;
+    memcpy(pHeader->magic, SESSION_MAGIC, sizeof(pHeader->magic));
+    pHeader->nSessions = nSessions;
+    pHeader->iRecordSize = sizeof(packed_t);
+  }
+  return pStore;
+}
+
+/* Map iSize bytes of fd (or anonymous memory if fd is -1), preferring huge pages if bHuge is set */
+void* mapSlab(int fd, size_t iSize, bool bHuge)
+{
+  void* pBase = MAP_FAILED;
+  if (fd < 0)
+  {
+    if (bHuge)
+      pBase = mmap(NULL, iSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pBase == MAP_FAILED) // Huge pages are not reserved; fall back to normal pages
+      pBase = mmap(NULL, iSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  }
+  else
+  {
+    pBase = mmap(NULL, iSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+
+  if (pBase == MAP_FAILED)
+  {
+    fprintf(stderr, "Unable to map session store: %s\n", strerror(errno));
+    return NULL;
+  }
+
+  // Transparent huge pages are only a hint; failure is harmless
+  if (bHuge)
+    madvise(pBase, iSize, MADV_HUGEPAGE);
+  return pBase;
+}
+
+/* Start session iId with the deck pPacked, replacing any deck it already had */
+bool sessionInit(sessionStore_t* pStore, uint64_t iId, packed_t* pPacked)
+{
+  if (iId >= pStore->nSessions)
+  {
+    fprintf(stderr, "Session %lu is out of range (%lu sessions).\n", (unsigned long)iId, (unsigned long)pStore->nSessions);
+    return false;
+  }
+
+  pthread_mutex_t* pLock = &pStore->locks[iId % SESSION_STRIPES];
+  pthread_mutex_lock(pLock);
+  pStore->pRecords[iId] = *pPacked;
+  pthread_mutex_unlock(pLock);
+  return true;
+}
+
+/* Encode/decode iLen cleaned chars with session iId's deck, continuing its keystream where the
+   last call left off. The lookup, keystream and store happen under the session's lock. */
+bool sessionCipher(sessionStore_t* pStore, uint64_t iId, bool bEncrypt, char* pInput, char* pOutput, size_t iLen)
+{
+  if (iId >= pStore->nSessions)
+  {
+    fprintf(stderr, "Session %lu is out of range (%lu sessions).\n", (unsigned long)iId, (unsigned long)pStore->nSessions);
+    return false;
+  }
+
+  pthread_mutex_t* pLock = &pStore->locks[iId % SESSION_STRIPES];
+  pthread_mutex_lock(pLock);
+  packed_t deck = pStore->pRecords[iId];
+  bool bUsed = deck.cards[0] != 0;
+  bool bValid = bUsed && isDeck(&deck);
+  if (bValid)
+  {
+    cipherPacked(bEncrypt, &deck, pInput, pOutput, iLen);
+    pStore->pRecords[iId] = deck;
+  }
+  pthread_mutex_unlock(pLock);
+
+  if (!bUsed)
+    fprintf(stderr, "Session %lu has not been started.\n", (unsigned long)iId);
+  else if (!bValid)
+    fprintf(stderr, "Session %lu's record is corrupt: it is not a deck of cards 1 to %d.\n", (unsigned long)iId, DECK_SIZE);
+  return bValid;
+}
+
+/* Check a record holds every card 1..DECK_SIZE exactly once, as stepping a deck relies on */
+static bool isDeck(const packed_t* pPacked)
+{
+  bool seen[DECK_SIZE + 1] = { false };
+  for (size_t i = 0; i < DECK_SIZE; i++)
+  {
+    unsigned iCard = pPacked->cards[i];
+    if (iCard < 1 || iCard > DECK_SIZE || seen[iCard])
+      return false;
+    seen[iCard] = true;
+  }
+  return true;
+}
+
+/* Flush a file-backed slab to disk and release the store */
+bool closeSessionStore(sessionStore_t* pStore)
+{
+  if (pStore == NULL)
+    return true;
+
+  bool bOk = msync(pStore->pBase, pStore->iMapSize, MS_SYNC) == 0;
+  if (munmap(pStore->pBase, pStore->iMapSize) != 0)
+    bOk = false;
+  if (pStore->iFd >= 0)
+    close(pStore->iFd); // Releases the file lock
+  for (size_t i = 0; i < SESSION_STRIPES; i++)
+    pthread_mutex_destroy(&pStore->locks[i]);
+  free(pStore);
+  if (!bOk)
+    fprintf(stderr, "Error writing session store: %s\n", strerror(errno));
+  return bOk;
+}
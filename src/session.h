@@ -0,0 +1,41 @@
+#ifndef SESSION_H
+#define SESSION_H
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "packed.h"
+
+#define SESSION_MAGIC "SOLSESS1"
+#define SESSION_HEADER_SIZE 4096 // Keeps the records page aligned
+#define SESSION_STRIPES 256
+
+/* The first page of a session slab */
+struct sessionHeader_tag
+{
+  char     magic[8];
+  uint64_t nSessions;
+  uint64_t iRecordSize;
+};
+typedef struct sessionHeader_tag sessionHeader_t;
+
+/* A slab of fixed 54-byte deck records indexed by session id. Session i's deck is record i;
+   a record of all zeros is an unused session. Access to each record is guarded by one of
+   SESSION_STRIPES locks, chosen by session id. A file-backed slab is also locked against other
+   processes for as long as the store is open. */
+struct sessionStore_tag
+{
+  int             iFd;        // The slab file, holding its lock; -1 for an anonymous slab
+  unsigned char*  pBase;
+  size_t          iMapSize;
+  packed_t*       pRecords;
+  uint64_t        nSessions;
+  pthread_mutex_t locks[SESSION_STRIPES];
+};
+typedef struct sessionStore_tag sessionStore_t;
+
+sessionStore_t* openSessionStore(const char* pFile, uint64_t nSessions, bool bHuge);
+bool sessionInit(sessionStore_t* pStore, uint64_t iId, packed_t* pPacked);
+bool sessionCipher(sessionStore_t* pStore, uint64_t iId, bool bEncrypt, char* pInput, char* pOutput, size_t iLen);
+bool closeSessionStore(sessionStore_t* pStore);
+#endif
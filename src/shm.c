@@ -0,0 +1,613 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cipher.h"
+#include "file.h"
+#include "filter.h"
+#include "shm.h"
+
+#define SHM_SPIN 2000   // Polls of an empty queue before sleeping on its futex
+#define SHM_WINDOW 256  // Requests a client mode keeps in flight
+
+_Static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "queues in shared memory need lock-free 64-bit atomics");
+_Static_assert((SHM_SLOTS & (SHM_SLOTS - 1)) == 0, "SHM_SLOTS must be a power of two");
+
+struct shmWorker_tag
+{
+  pthread_t       thread;
+  shmRegion_t*    pRegion;
+  sessionStore_t* pStore;
+};
+typedef struct shmWorker_tag shmWorker_t;
+
+static void queueInit(shmQueue_t* pQueue);
+static void queuePush(shmQueue_t* pQueue, uint64_t iValue);
+static bool queuePop(shmQueue_t* pQueue, uint64_t* pValue);
+static bool queuePopWait(shmRegion_t* pRegion, shmQueue_t* pQueue, uint64_t* pValue);
+static void queueWakeAll(shmQueue_t* pQueue);
+static void queueRepair(shmQueue_t* pQueue, shmQueue_t* pFree);
+static void reclaimClients(shmRegion_t* pRegion);
+static const char* shmError(int iStatus);
+static void* shmWorker(void* pArg);
+static void shmProcess(shmSlot_t* pSlot, cacheEntry_t* pCache, sessionStore_t* pStore);
+static int shmSession(char* pKey, bool bEncrypt, bool isDeck, char* pMessage, uint32_t* pLen,
+                      cacheEntry_t* pCache, sessionStore_t* pStore);
+
+static inline void spinPause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+/* Serve requests from the shared memory region pName (e.g. '/solitaire') with nThreads workers until SIGINT
+   or SIGTERM. The region is created here and removed on exit. Clients place a key and message in a free slot
+   and push the slot's index onto the request queue; a worker ciphers the message in place and pushes the
+   index onto the client's response queue. Idle workers and clients sleep on futexes in the region.
+   If pStore is not NULL, session keys ('@id=key' and '@id') are accepted as in filter mode. */
+bool runShmService(const char* pName, unsigned nThreads, sessionStore_t* pStore)
+{
+  if (nThreads == 0)
+    nThreads = 1;
+
+  int fd = shm_open(pName, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Unable to create shared memory '%s': %s.%s\n", pName, strerror(errno),
+            errno == EEXIST ? " Is another service running? Otherwise remove the stale region." : "");
+    return false;
+  }
+  if (ftruncate(fd, sizeof(shmRegion_t)) != 0)
+  {
+    fprintf(stderr, "Error sizing shared memory '%s': %s.\n", pName, strerror(errno));
+    close(fd);
+    shm_unlink(pName);
+    return false;
+  }
+  shmRegion_t* pRegion = mmap(NULL, sizeof(shmRegion_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (pRegion == MAP_FAILED)
+  {
+    fprintf(stderr, "Error mapping shared memory '%s': %s.\n", pName, strerror(errno));
+    shm_unlink(pName);
+    return false;
+  }
+
+  // A new region is zero filled; set up the queues and hand every slot to the free queue
+  queueInit(&pRegion->free);
+  queueInit(&pRegion->requests);
+  for (unsigned i = 0; i < SHM_MAX_CLIENTS; i++)
+    queueInit(&pRegion->responses[i]);
+  for (uint64_t i = 0; i < SHM_SLOTS; i++)
+    queuePush(&pRegion->free, i);
+  atomic_thread_fence(memory_order_release);
+  memcpy(pRegion->magic, SHM_MAGIC, sizeof(pRegion->magic));
+
+  // Only this thread takes the stop signals; the workers inherit the blocked mask
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  shmWorker_t* pWorkers = calloc(nThreads, sizeof(shmWorker_t));
+  unsigned nStarted = 0;
+  for (; nStarted < nThreads; nStarted++)
+  {
+    pWorkers[nStarted].pRegion = pRegion;
+    pWorkers[nStarted].pStore = pStore;
+    if (pthread_create(&pWorkers[nStarted].thread, NULL, shmWorker, &pWorkers[nStarted]) != 0)
+      break;
+  }
+
+  bool bOk = nStarted == nThreads;
+  if (bOk)
+  {
+    fprintf(stderr, "Serving on shared memory '%s' with %u workers; stop with Ctrl-C.\n", pName, nThreads);
+    int iSignal = 0;
+    sigwait(&signals, &iSignal);
+  }
+  else
+    fprintf(stderr, "Unable to start the service's worker threads.\n");
+
+  // Wake everything that sleeps in the region so workers and clients see the stop flag
+  atomic_store(&pRegion->bStopping, 1);
+  queueWakeAll(&pRegion->free);
+  queueWakeAll(&pRegion->requests);
+  for (unsigned i = 0; i < SHM_MAX_CLIENTS; i++)
+    queueWakeAll(&pRegion->responses[i]);
+  for (unsigned i = 0; i < nStarted; i++)
+    pthread_join(pWorkers[i].thread, NULL);
+  pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+  free(pWorkers);
+  munmap(pRegion, sizeof(shmRegion_t));
+  shm_unlink(pName);
+  return bOk;
+}
+
+/* Connect to the service on pName. Returns NULL if there is no service or every client id is in use. */
+shmClient_t* shmConnect(const char* pName)
+{
+  int fd = shm_open(pName, O_RDWR, 0);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Unable to open shared memory '%s': %s.\n", pName, strerror(errno));
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(shmRegion_t))
+  {
+    fprintf(stderr, "'%s' is not a solitaire service.\n", pName);
+    close(fd);
+    return NULL;
+  }
+  shmRegion_t* pRegion = mmap(NULL, sizeof(shmRegion_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (pRegion == MAP_FAILED)
+  {
+    fprintf(stderr, "Error mapping shared memory '%s': %s.\n", pName, strerror(errno));
+    return NULL;
+  }
+  if (memcmp(pRegion->magic, SHM_MAGIC, sizeof(pRegion->magic)) != 0)
+  {
+    fprintf(stderr, "'%s' is not a solitaire service.\n", pName);
+    munmap(pRegion, sizeof(shmRegion_t));
+    return NULL;
+  }
+  atomic_thread_fence(memory_order_acquire);
+
+  // Claim a free client id, and with it a response queue
+  reclaimClients(pRegion);
+  uint64_t iClients = atomic_load(&pRegion->iClients);
+  unsigned iId = 0;
+  do
+  {
+    if (iClients == UINT64_MAX)
+    {
+      fprintf(stderr, "Every client slot of '%s' is in use.\n", pName);
+      munmap(pRegion, sizeof(shmRegion_t));
+      return NULL;
+    }
+    iId = (unsigned)__builtin_ctzll(~iClients);
+  }
+  while (!atomic_compare_exchange_weak(&pRegion->iClients, &iClients, iClients | (1ULL << iId)));
+  atomic_store(&pRegion->pids[iId], (int32_t)getpid());
+
+  // Anything already on the response queue was meant for an earlier holder of this id
+  shmClient_t* pClient = malloc(sizeof(shmClient_t));
+  pClient->pRegion = pRegion;
+  pClient->iId = iId;
+  pClient->iEpoch = atomic_fetch_add(&pRegion->epochs[iId], 1) + 1;
+  queueRepair(&pRegion->responses[iId], &pRegion->free);
+  uint64_t iSlot = 0;
+  while (queuePop(&pRegion->responses[iId], &iSlot))
+  {
+    if (iSlot < SHM_SLOTS)
+      queuePush(&pRegion->free, iSlot);
+  }
+  return pClient;
+}
+
+/* Take a free slot to fill in, waiting if every slot is in use. Returns NULL if the service stopped. */
+shmSlot_t* shmAcquire(shmClient_t* pClient)
+{
+  uint64_t iSlot = 0;
+  do
+  {
+    if (!queuePopWait(pClient->pRegion, &pClient->pRegion->free, &iSlot))
+      return NULL;
+  }
+  while (iSlot >= SHM_SLOTS);
+  shmSlot_t* pSlot = &pClient->pRegion->slots[iSlot];
+  atomic_store(&pSlot->iHeld, pClient->iId + 1);
+  return pSlot;
+}
+
+/* Hand a filled slot to the service. The slot belongs to the service until shmComplete() returns it. */
+void shmSubmit(shmClient_t* pClient, shmSlot_t* pSlot)
+{
+  pSlot->iClient = pClient->iId;
+  pSlot->iEpoch = pClient->iEpoch;
+  atomic_store(&pSlot->iHeld, 0);
+  queuePush(&pClient->pRegion->requests, (uint64_t)(pSlot - pClient->pRegion->slots));
+}
+
+/* Wait for the next of this client's requests to finish, in any order. Returns NULL if the service stopped.
+   Late responses to a dead client that held this id before are returned to the free queue. */
+shmSlot_t* shmComplete(shmClient_t* pClient)
+{
+  shmRegion_t* pRegion = pClient->pRegion;
+  while (true)
+  {
+    uint64_t iSlot = 0;
+    if (!queuePopWait(pRegion, &pRegion->responses[pClient->iId], &iSlot))
+      return NULL;
+    if (iSlot >= SHM_SLOTS)
+      continue;
+    shmSlot_t* pSlot = &pRegion->slots[iSlot];
+    if (pSlot->iEpoch != pClient->iEpoch)
+    {
+      queuePush(&pRegion->free, iSlot);
+      continue;
+    }
+    atomic_store(&pSlot->iHeld, pClient->iId + 1);
+    return pSlot;
+  }
+}
+
+/* Return a finished slot to the free queue */
+void shmRelease(shmClient_t* pClient, shmSlot_t* pSlot)
+{
+  atomic_store(&pSlot->iHeld, 0);
+  queuePush(&pClient->pRegion->free, (uint64_t)(pSlot - pClient->pRegion->slots));
+}
+
+/* Give up the client id and unmap the region. Every submitted slot must have been completed first. */
+void shmDisconnect(shmClient_t* pClient)
+{
+  if (pClient == NULL)
+    return;
+  atomic_store(&pClient->pRegion->pids[pClient->iId], 0);
+  atomic_fetch_and(&pClient->pRegion->iClients, ~(1ULL << pClient->iId));
+  munmap(pClient->pRegion, sizeof(shmRegion_t));
+  free(pClient);
+}
+
+/* Send filter records ('message<TAB>key<TAB>mode', see runFilter()) from fIn to the service on pName and write
+   one result line per record to fOut, in input order. Up to SHM_WINDOW records are in flight at once. */
+bool runShmClient(const char* pName, FILE* fIn, FILE* fOut)
+{
+  shmClient_t* pClient = shmConnect(pName);
+  if (pClient == NULL)
+    return false;
+
+  shmSlot_t* pWindow[SHM_WINDOW] = { NULL }; // Finished slots waiting to be written, by tag
+  uint64_t iNext = 0; // Tag of the next record read
+  uint64_t iDone = 0; // Tag of the next result to write
+  char* pLine = NULL;
+  size_t iLineSize = 0;
+  bool bEof = false;
+  bool bOk = true;
+
+  while (bOk)
+  {
+    // Keep the window full
+    ssize_t iRead = 0;
+    while (!bEof && iNext - iDone < SHM_WINDOW)
+    {
+      if ((iRead = getline(&pLine, &iLineSize, fIn)) == -1)
+      {
+        bEof = true;
+        break;
+      }
+      shmSlot_t* pSlot = shmAcquire(pClient);
+      if (pSlot == NULL)
+      {
+        bOk = false;
+        break;
+      }
+      pSlot->iTag = iNext++;
+
+      // Split 'message<TAB>key<TAB>mode' straight into the slot
+      while (iRead > 0 && (pLine[iRead - 1] == '\n' || pLine[iRead - 1] == '\r'))
+        pLine[--iRead] = '\0';
+      char* pKey = strchr(pLine, '\t');
+      char* pMode = pKey != NULL ? strchr(pKey + 1, '\t') : NULL;
+      if (pMode == NULL)
+      {
+        pSlot->iStatus = SHM_BAD_RECORD;
+        pWindow[pSlot->iTag % SHM_WINDOW] = pSlot;
+        continue;
+      }
+      bool bEncrypt = true;
+      bool isDeck = true;
+      if (!parseMode(pMode + 1, &bEncrypt, &isDeck))
+      {
+        pSlot->iStatus = SHM_BAD_MODE;
+        pWindow[pSlot->iTag % SHM_WINDOW] = pSlot;
+        continue;
+      }
+      size_t iLen = (size_t)(pKey - pLine);
+      size_t iKeyLen = (size_t)(pMode - pKey - 1);
+      if (iKeyLen + 1 + iLen > SHM_SLOT_SIZE)
+      {
+        pSlot->iStatus = SHM_TOO_LONG;
+        pWindow[pSlot->iTag % SHM_WINDOW] = pSlot;
+        continue;
+      }
+      memcpy(pSlot->data, pKey + 1, iKeyLen);
+      pSlot->data[iKeyLen] = '\0';
+      memcpy(pSlot->data + iKeyLen + 1, pLine, iLen);
+      pSlot->iKeyLen = (uint32_t)iKeyLen;
+      pSlot->iLen = (uint32_t)iLen;
+      pSlot->iFlags = (bEncrypt ? 0 : SHM_DECRYPT) | (isDeck ? 0 : SHM_KEY_TEXT);
+      shmSubmit(pClient, pSlot);
+    }
+    if (!bOk || iDone == iNext)
+      break;
+
+    // Wait for the oldest record, then write every result that is ready in order
+    while (pWindow[iDone % SHM_WINDOW] == NULL)
+    {
+      shmSlot_t* pSlot = shmComplete(pClient);
+      if (pSlot == NULL)
+      {
+        bOk = false;
+        break;
+      }
+      pWindow[pSlot->iTag % SHM_WINDOW] = pSlot;
+    }
+    while (bOk && pWindow[iDone % SHM_WINDOW] != NULL)
+    {
+      shmSlot_t* pSlot = pWindow[iDone % SHM_WINDOW];
+      if (pSlot->iStatus == SHM_OK)
+        fwrite(pSlot->data + pSlot->iKeyLen + 1, sizeof(char), pSlot->iLen, fOut);
+      else
+      {
+        fprintf(stderr, "Record %lu: %s.\n", (unsigned long)(iDone + 1), shmError(pSlot->iStatus));
+        fputc('!', fOut);
+      }
+      fputc('\n', fOut);
+      pWindow[iDone % SHM_WINDOW] = NULL;
+      shmRelease(pClient, pSlot);
+      iDone++;
+    }
+  }
+
+  if (!bOk)
+    fprintf(stderr, "The service on '%s' stopped.\n", pName);
+  else if (ferror(fIn) || fflush(fOut) != 0)
+  {
+    fprintf(stderr, "Error reading records or writing results.\n");
+    bOk = false;
+  }
+  free(pLine);
+  shmDisconnect(pClient);
+  return bOk;
+}
+
+/* Free the ids of clients whose process has exited without disconnecting, and the slots they held.
+   Their requests still with the service come back on the response queue, and are freed by the next
+   client to claim the id. A client that dies in the instant between taking a slot or id and marking it
+   as its own leaks that one until the service restarts. */
+static void reclaimClients(shmRegion_t* pRegion)
+{
+  uint64_t iClients = atomic_load(&pRegion->iClients);
+  for (unsigned iId = 0; iId < SHM_MAX_CLIENTS; iId++)
+  {
+    int32_t iPid = atomic_load(&pRegion->pids[iId]);
+    if ((iClients & (1ULL << iId)) == 0 || iPid <= 0 || kill(iPid, 0) == 0 || errno != ESRCH)
+      continue;
+
+    // Only one connecting client may reclaim a given id; the winner marks it as connecting
+    if (!atomic_compare_exchange_strong(&pRegion->pids[iId], &iPid, 0))
+      continue;
+    for (uint64_t iSlot = 0; iSlot < SHM_SLOTS; iSlot++)
+    {
+      uint32_t iHeld = iId + 1;
+      if (atomic_compare_exchange_strong(&pRegion->slots[iSlot].iHeld, &iHeld, 0))
+        queuePush(&pRegion->free, iSlot);
+    }
+    atomic_fetch_and(&pRegion->iClients, ~(1ULL << iId));
+  }
+}
+
+static const char* shmError(int iStatus)
+{
+  switch (iStatus)
+  {
+  case SHM_BAD_KEY:
+    return "invalid key/deck";
+  case SHM_BAD_SESSION:
+    return "invalid session key or session";
+  case SHM_TOO_LONG:
+    return "key and message do not fit in a request slot";
+  case SHM_BAD_RECORD:
+    return "expected 'message<TAB>key<TAB>mode'";
+  case SHM_BAD_MODE:
+    return "mode must be 'e', 'd', 'ek' or 'dk'";
+  default:
+    return "unknown error";
+  }
+}
+
+/* Worker thread: take requests until the service stops */
+static void* shmWorker(void* pArg)
+{
+  shmWorker_t* pWorker = pArg;
+  shmRegion_t* pRegion = pWorker->pRegion;
+  cacheEntry_t* pCache = makeDeckCache();
+  uint64_t iSlot = 0;
+  while (queuePopWait(pRegion, &pRegion->requests, &iSlot))
+  {
+    if (iSlot >= SHM_SLOTS)
+      continue; // Clients write the queue too, so never trust an index from it
+    shmSlot_t* pSlot = &pRegion->slots[iSlot];
+    shmProcess(pSlot, pCache, pWorker->pStore);
+    uint32_t iClient = pSlot->iClient;
+    if (iClient < SHM_MAX_CLIENTS)
+      queuePush(&pRegion->responses[iClient], iSlot);
+  }
+  freeDeckCache(pCache);
+  return NULL;
+}
+
+/* Clean and cipher one request in place and set its status */
+static void shmProcess(shmSlot_t* pSlot, cacheEntry_t* pCache, sessionStore_t* pStore)
+{
+  // Read the lengths once; the client must not touch a submitted slot, but never trust it to stay in bounds
+  uint32_t iKeyLen = pSlot->iKeyLen;
+  uint32_t iLen = pSlot->iLen;
+  if ((uint64_t)iKeyLen + 1 + iLen > SHM_SLOT_SIZE || pSlot->data[iKeyLen] != '\0')
+  {
+    pSlot->iLen = 0;
+    pSlot->iStatus = SHM_TOO_LONG;
+    return;
+  }
+
+  char* pKey = pSlot->data;
+  char* pMessage = pSlot->data + iKeyLen + 1;
+  bool bEncrypt = (pSlot->iFlags & SHM_DECRYPT) == 0;
+  bool isDeck = (pSlot->iFlags & SHM_KEY_TEXT) == 0;
+  if (pStore != NULL && pKey[0] == '@')
+  {
+    pSlot->iStatus = shmSession(pKey, bEncrypt, isDeck, pMessage, &iLen, pCache, pStore);
+    pSlot->iLen = iLen;
+    return;
+  }
+
+  packed_t deck;
+  if (!cachedDeck(pCache, pKey, isDeck, &deck))
+  {
+    pSlot->iLen = 0;
+    pSlot->iStatus = SHM_BAD_KEY;
+    return;
+  }
+  iLen = (uint32_t)cleanBuffer(pMessage, iLen);
+  cipherPacked(bEncrypt, &deck, pMessage, pMessage, iLen);
+  pSlot->iLen = iLen;
+  pSlot->iStatus = SHM_OK;
+}
+
+/* Cipher a request against a stored session. The key is '@id' or '@id=key'. */
+static int shmSession(char* pKey, bool bEncrypt, bool isDeck, char* pMessage, uint32_t* pLen,
+                      cacheEntry_t* pCache, sessionStore_t* pStore)
+{
+  char* pEnd = NULL;
+  uint64_t iId = strtoull(pKey + 1, &pEnd, 10);
+  if (pEnd == pKey + 1 || (*pEnd != '\0' && *pEnd != '='))
+    return SHM_BAD_SESSION;
+
+  if (*pEnd == '=')
+  {
+    packed_t deck;
+    if (!cachedDeck(pCache, pEnd + 1, isDeck, &deck))
+      return SHM_BAD_KEY;
+    if (!sessionInit(pStore, iId, &deck))
+      return SHM_BAD_SESSION;
+  }
+
+  *pLen = (uint32_t)cleanBuffer(pMessage, *pLen);
+  if (!sessionCipher(pStore, iId, bEncrypt, pMessage, pMessage, *pLen))
+    return SHM_BAD_SESSION;
+  return SHM_OK;
+}
+
+static void queueInit(shmQueue_t* pQueue)
+{
+  pQueue->iMask = SHM_SLOTS - 1;
+  for (uint64_t i = 0; i < SHM_SLOTS; i++)
+    atomic_store_explicit(&pQueue->cells[i].seq, i, memory_order_relaxed);
+}
+
+/* Push iValue and wake one sleeping consumer. The queue has room for every slot, so it is never full. */
+static void queuePush(shmQueue_t* pQueue, uint64_t iValue)
+{
+  uint64_t iPos = atomic_load_explicit(&pQueue->enqueue, memory_order_relaxed);
+  shmCell_t* pCell = NULL;
+  while (true)
+  {
+    pCell = &pQueue->cells[iPos & pQueue->iMask];
+    int64_t iDiff = (int64_t)atomic_load_explicit(&pCell->seq, memory_order_acquire) - (int64_t)iPos;
+    if (iDiff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&pQueue->enqueue, &iPos, iPos + 1, memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else
+      iPos = atomic_load_explicit(&pQueue->enqueue, memory_order_relaxed);
+  }
+  pCell->value = iValue;
+  atomic_store_explicit(&pCell->seq, iPos + 1, memory_order_release);
+
+  // Bumping signal after the push means a consumer about to sleep either sees the value or a changed futex word
+  atomic_fetch_add(&pQueue->signal, 1);
+  if (atomic_load(&pQueue->nWaiters) > 0)
+    syscall(SYS_futex, &pQueue->signal, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* Pop into pValue without waiting. Returns false if the queue is empty. */
+static bool queuePop(shmQueue_t* pQueue, uint64_t* pValue)
+{
+  uint64_t iPos = atomic_load_explicit(&pQueue->dequeue, memory_order_relaxed);
+  shmCell_t* pCell = NULL;
+  while (true)
+  {
+    pCell = &pQueue->cells[iPos & pQueue->iMask];
+    int64_t iDiff = (int64_t)atomic_load_explicit(&pCell->seq, memory_order_acquire) - (int64_t)(iPos + 1);
+    if (iDiff == 0)
+    {
+      if (atomic_compare_exchange_weak_explicit(&pQueue->dequeue, &iPos, iPos + 1, memory_order_relaxed, memory_order_relaxed))
+        break;
+    }
+    else if (iDiff < 0)
+      return false;
+    else
+      iPos = atomic_load_explicit(&pQueue->dequeue, memory_order_relaxed);
+  }
+  *pValue = pCell->value;
+  atomic_store_explicit(&pCell->seq, iPos + pQueue->iMask + 1, memory_order_release);
+  return true;
+}
+
+/* Pop into pValue, spinning briefly and then sleeping on the queue's futex while it is empty.
+   Returns false if the service is stopping. */
+static bool queuePopWait(shmRegion_t* pRegion, shmQueue_t* pQueue, uint64_t* pValue)
+{
+  for (unsigned i = 0; i < SHM_SPIN; i++)
+  {
+    if (queuePop(pQueue, pValue))
+      return true;
+    spinPause();
+  }
+
+  while (true)
+  {
+    uint32_t iSignal = atomic_load(&pQueue->signal);
+    atomic_fetch_add(&pQueue->nWaiters, 1);
+    bool bFound = queuePop(pQueue, pValue);
+    bool bStopping = atomic_load(&pRegion->bStopping) != 0;
+    if (!bFound && !bStopping)
+      syscall(SYS_futex, &pQueue->signal, FUTEX_WAIT, iSignal, NULL, NULL, 0);
+    atomic_fetch_sub(&pQueue->nWaiters, 1);
+    if (bFound)
+      return true;
+    if (bStopping)
+      return false;
+  }
+}
+
+/* Wake every consumer sleeping on pQueue */
+static void queueWakeAll(shmQueue_t* pQueue)
+{
+  atomic_fetch_add(&pQueue->signal, 1);
+  syscall(SYS_futex, &pQueue->signal, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Finish any pop of the single-consumer queue pQueue that its consumer died in the middle of: the cell was
+   taken but never handed back, so producers would wait on it forever. The slot it held goes to pFree.
+   Only call with the queue's consumer gone and no other consumer. */
+static void queueRepair(shmQueue_t* pQueue, shmQueue_t* pFree)
+{
+  uint64_t iDequeue = atomic_load(&pQueue->dequeue);
+  for (uint64_t iPos = iDequeue > SHM_SLOTS ? iDequeue - SHM_SLOTS : 0; iPos < iDequeue; iPos++)
+  {
+    shmCell_t* pCell = &pQueue->cells[iPos & pQueue->iMask];
+    if (atomic_load(&pCell->seq) != iPos + 1)
+      continue;
+    uint64_t iSlot = pCell->value;
+    atomic_store(&pCell->seq, iPos + pQueue->iMask + 1);
+    if (iSlot < SHM_SLOTS)
+      queuePush(pFree, iSlot);
+  }
+}
@@ -0,0 +1,101 @@
+#ifndef SHM_H
+#define SHM_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "session.h"
+
+#define SHM_MAGIC "SOLSHM2"
+#define SHM_SLOTS 1024       // Requests in flight across all clients; a power of two
+#define SHM_SLOT_SIZE 4096   // Bytes of key and message per request
+#define SHM_MAX_CLIENTS 64   // Each connected client owns one response ring
+
+/* Request flags */
+#define SHM_DECRYPT  1 // Decrypt rather than encrypt
+#define SHM_KEY_TEXT 2 // The key is key text rather than a deck order
+
+/* Request status, set by the service */
+#define SHM_OK           0
+#define SHM_BAD_KEY      1 // The key/deck was invalid
+#define SHM_BAD_SESSION  2 // The session key was malformed or the session could not be used
+#define SHM_TOO_LONG     3 // The key and message did not fit in the slot
+#define SHM_BAD_RECORD   4 // Set by client mode for an input line that is not a record
+#define SHM_BAD_MODE     5 // Set by client mode for a record whose mode is not 'e', 'd', 'ek' or 'dk'
+
+/* One cell of a bounded multi-producer/multi-consumer queue (Vyukov). seq tells producers and consumers
+   whose turn the cell is; value is a slot index. */
+struct shmCell_tag
+{
+  _Atomic uint64_t seq;
+  uint64_t         value;
+};
+typedef struct shmCell_tag shmCell_t;
+
+/* A queue of slot indices in the shared region. Every slot index is in at most one queue at a time
+   and each queue has room for every slot, so a push never fails.
+   signal is a futex word bumped after every push; idle consumers sleep on it. */
+struct shmQueue_tag
+{
+  _Alignas(64) _Atomic uint64_t enqueue;
+  _Alignas(64) _Atomic uint64_t dequeue;
+  _Alignas(64) _Atomic uint32_t signal;
+  _Atomic uint32_t              nWaiters;
+  uint64_t                      iMask;
+  _Alignas(64) shmCell_t        cells[SHM_SLOTS];
+};
+typedef struct shmQueue_tag shmQueue_t;
+
+/* A request. The client writes the key text followed by '\0' and then the message into data, and the
+   service cleans and ciphers the message in place. The key may be '@id=key' to start session id or
+   '@id' to continue it, when the service has a session store. */
+struct shmSlot_tag
+{
+  uint64_t         iTag;     // The client's own value, returned untouched
+  _Atomic uint32_t iHeld;    // Client id + 1 while a client holds the slot outside the queues, else 0
+  uint32_t         iEpoch;   // The submitting client's epoch, to spot responses meant for a dead client
+  uint32_t         iClient;  // Response ring the result goes to
+  uint32_t         iFlags;   // SHM_DECRYPT, SHM_KEY_TEXT
+  uint32_t         iKeyLen;  // Bytes of key text, not counting its terminator
+  uint32_t         iLen;     // Bytes of message; on return, bytes of cleaned, ciphered message
+  int32_t          iStatus;  // SHM_OK or an error
+  char             data[SHM_SLOT_SIZE];
+};
+typedef struct shmSlot_tag shmSlot_t;
+
+/* The shared region. magic is written last, so a client that sees it sees a ready region.
+   A client that exits without disconnecting keeps its id and slots until the next shmConnect() finds
+   its process gone and reclaims them. */
+struct shmRegion_tag
+{
+  char                  magic[8];
+  _Atomic uint32_t      bStopping;
+  _Atomic uint64_t      iClients; // Bit i is set while client i is connected
+  _Atomic int32_t       pids[SHM_MAX_CLIENTS];   // Process of each connected client, 0 while connecting
+  _Atomic uint32_t      epochs[SHM_MAX_CLIENTS]; // Bumped each time a client id is claimed
+  shmQueue_t            free;
+  shmQueue_t            requests;
+  shmQueue_t            responses[SHM_MAX_CLIENTS];
+  _Alignas(64) shmSlot_t slots[SHM_SLOTS];
+};
+typedef struct shmRegion_tag shmRegion_t;
+
+/* A connection to a running service */
+struct shmClient_tag
+{
+  shmRegion_t* pRegion;
+  unsigned     iId;
+  uint32_t     iEpoch;
+};
+typedef struct shmClient_tag shmClient_t;
+
+bool runShmService(const char* pName, unsigned nThreads, sessionStore_t* pStore);
+shmClient_t* shmConnect(const char* pName);
+shmSlot_t* shmAcquire(shmClient_t* pClient);
+void shmSubmit(shmClient_t* pClient, shmSlot_t* pSlot);
+shmSlot_t* shmComplete(shmClient_t* pClient);
+void shmRelease(shmClient_t* pClient, shmSlot_t* pSlot);
+void shmDisconnect(shmClient_t* pClient);
+bool runShmClient(const char* pName, FILE* fIn, FILE* fOut);
+#endif
@@ -0,0 +1,586 @@
+#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mini.h"
+
+/* Recover candidate starting decks from a known keystream.
+
+   The search runs the deck forward symbolically. Each card of the starting deck is tracked by its
+   starting position (its slot), and a slot's card number stays unknown until a step needs it: finding
+   a Joker, reading the bottom card for the count cut, or reading the top and output cards. At each of
+   those points the search branches over the cards still unused, and an output card may only be a card
+   whose value matches the observed keystream. Unknown cards that never influence the keystream stay
+   unknown and are printed as '?'.
+
+   States in the top SPLIT_DEPTH keystream positions are split into tasks that workers share by work
+   stealing, up to MAX_TASKS open tasks per worker. Below that depth each worker searches depth first and remembers the partial decks it has proven
+   dead (a lossy table of 64-bit hashes), since several starting decks can lead to the same partial deck. */
+
+#define SPLIT_DEPTH 3
+#define MAX_TASKS 4096 // Open tasks per worker before shallow states are searched in place
+#define DEAD_TABLE_SIZE (1 << 22)
+
+struct solveState_tag
+{
+  unsigned char slot[MINI_MAX]; // Position -> slot (starting position of the card there)
+  unsigned char card[MINI_MAX]; // Slot -> card number, 0 if not yet known
+  uint64_t      used;           // Bit c is set once card c has been given to a slot
+  unsigned      t;              // Keystream values matched so far
+  unsigned      nSteps;         // Deck steps taken, including steps whose output was a Joker
+};
+typedef struct solveState_tag solveState_t;
+
+struct deque_tag
+{
+  pthread_mutex_t lock;
+  solveState_t*   pItems;
+  size_t          iHead; // Thieves take from the head
+  size_t          iTail; // The owner pushes and pops at the tail
+  size_t          nCapacity;
+};
+typedef struct deque_tag deque_t;
+
+struct solver_tag
+{
+  unsigned          n;
+  unsigned*         pObserved;
+  unsigned          nObserved;
+  unsigned          nMaxSteps;
+  unsigned          nWorkers;
+  deque_t*          pDeques;
+  _Atomic uint64_t* pDead;
+  atomic_size_t     nPending; // Tasks pushed but not yet finished
+  atomic_ullong     nNodes;
+  atomic_ullong     nSolutions;
+  unsigned long     nMaxPrint;
+  pthread_mutex_t   printLock;
+};
+typedef struct solver_tag solver_t;
+
+struct worker_tag
+{
+  solver_t* pSolver;
+  unsigned  iId;
+  uint64_t  nFound; // Solutions found by this worker
+  uint64_t  nCut;   // States this worker abandoned at the step limit
+  unsigned  iLocal; // Nonzero while searching a subtree without sharing it
+};
+typedef struct worker_tag worker_t;
+
+void usage();
+unsigned* readKeystream(const char* pFile, unsigned n, unsigned* pCount);
+void* solveWorker(void* pArg);
+void visit(worker_t* pWorker, solveState_t* pState);
+void expand(worker_t* pWorker, solveState_t* pState, unsigned iStage);
+void finishStep(worker_t* pWorker, solveState_t* pState, unsigned iOut);
+void report(worker_t* pWorker, solveState_t* pState);
+int findCard(solveState_t* pState, unsigned n, unsigned iCard);
+void moveSlot(solveState_t* pState, unsigned n, unsigned iFrom, unsigned iShift);
+void cutSlots(solveState_t* pState, unsigned n, unsigned iFirst, unsigned iSecond);
+void countCutSlots(solveState_t* pState, unsigned n, unsigned iValue);
+uint64_t stateHash(solveState_t* pState, unsigned n);
+void pushTask(solver_t* pSolver, unsigned iWorker, solveState_t* pState);
+bool popTask(solver_t* pSolver, unsigned iWorker, bool bSteal, solveState_t* pState);
+
+/* Usage: solitaire-solve [-n cards] [-j threads] [-m max printed] file
+   The file holds the known keystream as whitespace-separated numbers, or (full decks only)
+   a plaintext line followed by its ciphertext line. */
+int main(int argc, char **argv)
+{
+  unsigned n = 10;
+  unsigned nWorkers = (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+  unsigned long nMaxPrint = 20;
+  int c = -1;
+  while ((c = getopt(argc, argv, "j:m:n:")) != -1)
+  {
+    switch (c)
+    {
+    case 'j':
+      nWorkers = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    case 'm':
+      nMaxPrint = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      n = (unsigned)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc - 1 || n < 3 || n > MINI_MAX)
+  {
+    usage();
+    return EXIT_FAILURE;
+  }
+  if (nWorkers == 0)
+    nWorkers = 1;
+
+  solver_t solver;
+  memset(&solver, 0, sizeof(solver));
+  solver.n = n;
+  solver.pObserved = readKeystream(argv[optind], n, &solver.nObserved);
+  if (solver.pObserved == NULL)
+    return EXIT_FAILURE;
+  solver.nMaxSteps = 2 * solver.nObserved + 2 * n;
+  solver.nWorkers = nWorkers;
+  solver.nMaxPrint = nMaxPrint;
+  solver.pDead = calloc(DEAD_TABLE_SIZE, sizeof(uint64_t));
+  solver.pDeques = calloc(nWorkers, sizeof(deque_t));
+  pthread_mutex_init(&solver.printLock, NULL);
+  for (unsigned i = 0; i < nWorkers; i++)
+    pthread_mutex_init(&solver.pDeques[i].lock, NULL);
+
+  // The root: every slot is in its starting position and nothing is known
+  solveState_t root;
+  memset(&root, 0, sizeof(root));
+  for (unsigned i = 0; i < n; i++)
+    root.slot[i] = (unsigned char)i;
+  pushTask(&solver, 0, &root);
+
+  fprintf(stderr, "Solving %u keystream values for a %u card deck with %u workers...\n", solver.nObserved, n, nWorkers);
+  worker_t* pWorkers = calloc(nWorkers, sizeof(worker_t));
+  pthread_t* pThreads = calloc(nWorkers, sizeof(pthread_t));
+  unsigned nStarted = 0;
+  for (; nStarted < nWorkers; nStarted++)
+  {
+    pWorkers[nStarted].pSolver = &solver;
+    pWorkers[nStarted].iId = nStarted;
+    if (pthread_create(&pThreads[nStarted], NULL, solveWorker, &pWorkers[nStarted]) != 0)
+      break;
+  }
+
+  // Workers steal from every deque, so any that did start finish the search; with none, search here
+  if (nStarted < nWorkers)
+    fprintf(stderr, "Started %u of %u worker threads.\n", nStarted, nWorkers);
+  if (nStarted == 0)
+    solveWorker(&pWorkers[0]);
+
+  // Report progress about once a second until every task is finished
+  for (unsigned iTick = 1; atomic_load(&solver.nPending) > 0; iTick++)
+  {
+    struct timespec delay = { 0, 10000000 };
+    nanosleep(&delay, NULL);
+    if (iTick % 100 != 0)
+      continue;
+    fprintf(stderr, "  %llu nodes, %llu candidates, %zu open tasks\n",
+            (unsigned long long)atomic_load(&solver.nNodes), (unsigned long long)atomic_load(&solver.nSolutions),
+            atomic_load(&solver.nPending));
+  }
+  for (unsigned i = 0; i < nStarted; i++)
+    pthread_join(pThreads[i], NULL);
+
+  printf("%llu candidate starting decks ('?' is any unused card), %llu nodes searched\n",
+         (unsigned long long)atomic_load(&solver.nSolutions), (unsigned long long)atomic_load(&solver.nNodes));
+
+  // A branch abandoned at the step limit may have held more candidates
+  uint64_t nCut = 0;
+  for (unsigned i = 0; i < nWorkers; i++)
+    nCut += pWorkers[i].nCut;
+  if (nCut > 0)
+    fprintf(stderr, "%llu states reached the step limit of %u, so the candidate list may be incomplete.\n",
+            (unsigned long long)nCut, solver.nMaxSteps);
+
+  for (unsigned i = 0; i < nWorkers; i++)
+  {
+    free(solver.pDeques[i].pItems);
+    pthread_mutex_destroy(&solver.pDeques[i].lock);
+  }
+  free(solver.pDeques);
+  free(solver.pDead);
+  free(solver.pObserved);
+  free(pWorkers);
+  free(pThreads);
+  return nCut > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void usage()
+{
+  fprintf(stderr, "Usage: solitaire-solve [-n cards] [-j threads] [-m max printed] keystream.txt\n");
+}
+
+/* Read the known keystream from pFile. Returns an allocated array, or NULL on error. */
+unsigned* readKeystream(const char* pFile, unsigned n, unsigned* pCount)
+{
+  FILE* f = fopen(pFile, "r");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Error opening file '%s'.\n", pFile);
+    return NULL;
+  }
+
+  // Read the whole file; it is either numbers or two lines of letters
+  char* pText = NULL;
+  size_t iSize = 0;
+  ssize_t iRead = getdelim(&pText, &iSize, '\0', f);
+  fclose(f);
+  if (iRead <= 0)
+  {
+    fprintf(stderr, "File '%s' was empty.\n", pFile);
+    free(pText);
+    return NULL;
+  }
+
+  unsigned iModulus = (n == 54) ? 26 : n - 2;
+  unsigned* pValues = malloc((size_t)iRead * sizeof(unsigned));
+  unsigned nValues = 0;
+  bool bOk = true;
+  if (isalpha((unsigned char)pText[strspn(pText, " \t\r\n")]))
+  {
+    // Known plaintext/ciphertext: the keystream is their difference mod 26
+    char* pCipher = strchr(pText, '\n');
+    if (n != 54 || pCipher == NULL)
+    {
+      fprintf(stderr, "A plaintext/ciphertext pair needs a full 54 card deck and two lines.\n");
+      bOk = false;
+    }
+    else
+    {
+      *pCipher++ = '\0';
+      const char* pPlain = pText;
+      while (*pPlain != '\0' && *pCipher != '\0')
+      {
+        if (!isalpha((unsigned char)*pPlain))
+          pPlain++;
+        else if (!isalpha((unsigned char)*pCipher))
+          pCipher++;
+        else
+        {
+          int iKey = (toupper((unsigned char)*pCipher++) - toupper((unsigned char)*pPlain++) + 26) % 26;
+          pValues[nValues++] = iKey == 0 ? 26 : (unsigned)iKey;
+        }
+      }
+    }
+  }
+  else
+  {
+    char* pEnd = pText;
+    while (bOk)
+    {
+      char* pStart = pEnd;
+      unsigned long iValue = strtoul(pStart, &pEnd, 10);
+      if (pEnd == pStart)
+        break;
+      if (iValue < 1 || iValue > iModulus)
+      {
+        fprintf(stderr, "Keystream value %lu is not between 1 and %u.\n", iValue, iModulus);
+        bOk = false;
+      }
+      pValues[nValues++] = (unsigned)iValue;
+    }
+  }
+  free(pText);
+
+  if (bOk && nValues == 0)
+  {
+    fprintf(stderr, "No keystream values were found in '%s'.\n", pFile);
+    bOk = false;
+  }
+  if (!bOk)
+  {
+    free(pValues);
+    return NULL;
+  }
+  *pCount = nValues;
+  return pValues;
+}
+
+/* Worker thread: run tasks from its own deque, stealing from the others when it runs dry */
+void* solveWorker(void* pArg)
+{
+  worker_t* pWorker = pArg;
+  solver_t* pSolver = pWorker->pSolver;
+  solveState_t state;
+  while (true)
+  {
+    bool bFound = popTask(pSolver, pWorker->iId, false, &state);
+    for (unsigned i = 1; !bFound && i < pSolver->nWorkers; i++)
+      bFound = popTask(pSolver, (pWorker->iId + i) % pSolver->nWorkers, true, &state);
+
+    if (!bFound)
+    {
+      if (atomic_load(&pSolver->nPending) == 0)
+        break;
+      sched_yield();
+      continue;
+    }
+
+    expand(pWorker, &state, 0);
+    atomic_fetch_sub(&pSolver->nPending, 1);
+  }
+  return NULL;
+}
+
+/* Handle a state at a step boundary: record it as a solution, split it off as a task, or search it here */
+void visit(worker_t* pWorker, solveState_t* pState)
+{
+  solver_t* pSolver = pWorker->pSolver;
+  atomic_fetch_add_explicit(&pSolver->nNodes, 1, memory_order_relaxed);
+
+  if (pState->t == pSolver->nObserved)
+  {
+    report(pWorker, pState);
+    return;
+  }
+  if (pState->nSteps >= pSolver->nMaxSteps)
+  {
+    pWorker->nCut++;
+    return;
+  }
+
+  // Share shallow states while there is room; a subtree searched here is searched entirely here
+  if (pWorker->iLocal == 0 && pState->t < SPLIT_DEPTH &&
+      atomic_load_explicit(&pSolver->nPending, memory_order_relaxed) < MAX_TASKS * pSolver->nWorkers)
+  {
+    pushTask(pSolver, pWorker->iId, pState);
+    return;
+  }
+
+  // Skip partial decks already proven to have no solutions at this keystream position
+  uint64_t iHash = stateHash(pState, pSolver->n) | 1; // 0 marks an empty table entry
+  _Atomic uint64_t* pEntry = &pSolver->pDead[iHash % DEAD_TABLE_SIZE];
+  if (atomic_load_explicit(pEntry, memory_order_relaxed) == iHash)
+    return;
+
+  // The hash ignores nSteps, so only a subtree searched to the end without meeting the step limit is proven dead
+  uint64_t nBefore = pWorker->nFound;
+  uint64_t nCutBefore = pWorker->nCut;
+  pWorker->iLocal++;
+  expand(pWorker, pState, 0);
+  pWorker->iLocal--;
+  if (pWorker->nFound == nBefore && pWorker->nCut == nCutBefore)
+    atomic_store_explicit(pEntry, iHash, memory_order_relaxed);
+}
+
+/* Run one deck step from pState, branching wherever an unknown card's number is needed.
+   Stage 0 moves the A Joker, 1 moves the B Joker, 2 does both cuts and 3 reads the output. */
+void expand(worker_t* pWorker, solveState_t* pState, unsigned iStage)
+{
+  solver_t* pSolver = pWorker->pSolver;
+  unsigned n = pSolver->n;
+
+  if (iStage <= 1)
+  {
+    unsigned iJoker = n - 1 + iStage;
+    int iPos = findCard(pState, n, iJoker);
+    if (iPos < 0)
+    {
+      // Branch over every position that could be holding this Joker
+      for (unsigned p = 0; p < n; p++)
+      {
+        if (pState->card[pState->slot[p]] == 0)
+        {
+          solveState_t child = *pState;
+          child.card[child.slot[p]] = (unsigned char)iJoker;
+          child.used |= 1ULL << iJoker;
+          expand(pWorker, &child, iStage);
+        }
+      }
+      return;
+    }
+    solveState_t next = *pState;
+    moveSlot(&next, n, (unsigned)iPos, iStage + 1);
+    expand(pWorker, &next, iStage + 1);
+    return;
+  }
+
+  if (iStage == 2)
+  {
+    solveState_t next = *pState;
+    unsigned iA = (unsigned)findCard(&next, n, n - 1);
+    unsigned iB = (unsigned)findCard(&next, n, n);
+    cutSlots(&next, n, iA < iB ? iA : iB, iA < iB ? iB : iA);
+
+    unsigned char* pBottom = &next.card[next.slot[n - 1]];
+    if (*pBottom != 0)
+    {
+      countCutSlots(&next, n, miniCutValue(*pBottom, n));
+      expand(pWorker, &next, 3);
+      return;
+    }
+    for (unsigned c = 1; c <= n - 2; c++)
+    {
+      if ((next.used & (1ULL << c)) == 0)
+      {
+        solveState_t child = next;
+        child.card[child.slot[n - 1]] = (unsigned char)c;
+        child.used |= 1ULL << c;
+        countCutSlots(&child, n, miniCutValue(c, n));
+        expand(pWorker, &child, 3);
+      }
+    }
+    return;
+  }
+
+  // Stage 3: the top card picks the output card, which must match the observed keystream
+  unsigned iTop = pState->card[pState->slot[0]];
+  if (iTop == 0)
+  {
+    for (unsigned c = 1; c <= n - 2; c++)
+    {
+      if ((pState->used & (1ULL << c)) == 0)
+      {
+        solveState_t child = *pState;
+        child.card[child.slot[0]] = (unsigned char)c;
+        child.used |= 1ULL << c;
+        expand(pWorker, &child, 3);
+      }
+    }
+    return;
+  }
+
+  unsigned iSlot = pState->slot[miniCutValue(iTop, n)];
+  unsigned iOutCard = pState->card[iSlot];
+  if (iOutCard != 0)
+  {
+    finishStep(pWorker, pState, miniOutValue(iOutCard, n));
+    return;
+  }
+
+  unsigned iWant = pSolver->pObserved[pState->t];
+  for (unsigned c = 1; c <= n - 2; c++)
+  {
+    if ((pState->used & (1ULL << c)) == 0 && miniOutValue(c, n) == iWant)
+    {
+      solveState_t child = *pState;
+      child.card[iSlot] = (unsigned char)c;
+      child.used |= 1ULL << c;
+      finishStep(pWorker, &child, iWant);
+    }
+  }
+}
+
+/* Complete a step whose output was iOut (0 for a Joker) */
+void finishStep(worker_t* pWorker, solveState_t* pState, unsigned iOut)
+{
+  if (iOut != 0 && iOut != pWorker->pSolver->pObserved[pState->t])
+    return;
+
+  solveState_t next = *pState;
+  next.nSteps++;
+  if (iOut != 0)
+    next.t++;
+  visit(pWorker, &next);
+}
+
+/* Print a candidate starting deck */
+void report(worker_t* pWorker, solveState_t* pState)
+{
+  solver_t* pSolver = pWorker->pSolver;
+  pWorker->nFound++;
+  unsigned long long iFound = atomic_fetch_add(&pSolver->nSolutions, 1) + 1;
+  if (iFound > pSolver->nMaxPrint)
+    return;
+
+  pthread_mutex_lock(&pSolver->printLock);
+  for (unsigned s = 0; s < pSolver->n; s++)
+  {
+    if (pState->card[s] == 0)
+      printf("%s?", s == 0 ? "" : " ");
+    else
+      printf("%s%u", s == 0 ? "" : " ", pState->card[s]);
+  }
+  printf("\n");
+  pthread_mutex_unlock(&pSolver->printLock);
+}
+
+/* Position of iCard, or -1 if no slot is known to hold it */
+int findCard(solveState_t* pState, unsigned n, unsigned iCard)
+{
+  for (unsigned p = 0; p < n; p++)
+  {
+    if (pState->card[pState->slot[p]] == iCard)
+      return (int)p;
+  }
+  return -1;
+}
+
+/* Move the slot at iFrom down iShift places, wrapping around to just below the top */
+void moveSlot(solveState_t* pState, unsigned n, unsigned iFrom, unsigned iShift)
+{
+  unsigned char iSlot = pState->slot[iFrom];
+  unsigned iTo = iFrom + iShift;
+  if (iTo >= n)
+    iTo = iTo - n + 1;
+
+  if (iTo > iFrom)
+    memmove(pState->slot + iFrom, pState->slot + iFrom + 1, iTo - iFrom);
+  else
+    memmove(pState->slot + iTo + 1, pState->slot + iTo, iFrom - iTo);
+  pState->slot[iTo] = iSlot;
+}
+
+/* Triple cut around the Jokers at iFirst and iSecond */
+void cutSlots(solveState_t* pState, unsigned n, unsigned iFirst, unsigned iSecond)
+{
+  unsigned char pTemp[MINI_MAX];
+  unsigned iBottom = n - 1 - iSecond;
+  memcpy(pTemp, pState->slot + iSecond + 1, iBottom);
+  memcpy(pTemp + iBottom, pState->slot + iFirst, iSecond - iFirst + 1);
+  memcpy(pTemp + iBottom + iSecond - iFirst + 1, pState->slot, iFirst);
+  memcpy(pState->slot, pTemp, n);
+}
+
+/* Count cut: move the top iValue slots above the bottom slot */
+void countCutSlots(solveState_t* pState, unsigned n, unsigned iValue)
+{
+  unsigned char pTemp[MINI_MAX];
+  memcpy(pTemp, pState->slot + iValue, n - 1 - iValue);
+  memcpy(pTemp + n - 1 - iValue, pState->slot, iValue);
+  memcpy(pState->slot, pTemp, n - 1);
+}
+
+/* FNV-1a of the keystream position and the partial deck as seen now (card numbers by position, 0 if unknown).
+   The future of the search depends only on these, not on which starting deck led here. */
+uint64_t stateHash(solveState_t* pState, unsigned n)
+{
+  uint64_t iHash = (14695981039346656037ULL ^ pState->t) * 1099511628211ULL; // Its own round, so t cannot cancel a card
+  for (unsigned p = 0; p < n; p++)
+    iHash = (iHash ^ pState->card[pState->slot[p]]) * 1099511628211ULL;
+  return iHash;
+}
+
+/* Push a task onto worker iWorker's deque */
+void pushTask(solver_t* pSolver, unsigned iWorker, solveState_t* pState)
+{
+  deque_t* pDeque = &pSolver->pDeques[iWorker];
+  atomic_fetch_add(&pSolver->nPending, 1);
+  pthread_mutex_lock(&pDeque->lock);
+  if (pDeque->iTail == pDeque->nCapacity)
+  {
+    // Slide the live items to the front before growing
+    memmove(pDeque->pItems, pDeque->pItems + pDeque->iHead, (pDeque->iTail - pDeque->iHead) * sizeof(solveState_t));
+    pDeque->iTail -= pDeque->iHead;
+    pDeque->iHead = 0;
+    if (pDeque->iTail == pDeque->nCapacity)
+    {
+      pDeque->nCapacity = pDeque->nCapacity == 0 ? 64 : 2 * pDeque->nCapacity;
+      pDeque->pItems = realloc(pDeque->pItems, pDeque->nCapacity * sizeof(solveState_t));
+    }
+  }
+  pDeque->pItems[pDeque->iTail++] = *pState;
+  pthread_mutex_unlock(&pDeque->lock);
+}
+
+/* Take a task from worker iWorker's deque: the newest for its owner, or the oldest (largest) for a thief */
+bool popTask(solver_t* pSolver, unsigned iWorker, bool bSteal, solveState_t* pState)
+{
+  deque_t* pDeque = &pSolver->pDeques[iWorker];
+  pthread_mutex_lock(&pDeque->lock);
+  bool bFound = pDeque->iHead < pDeque->iTail;
+  if (bFound)
+    *pState = bSteal ? pDeque->pItems[pDeque->iHead++] : pDeque->pItems[--pDeque->iTail];
+  pthread_mutex_unlock(&pDeque->lock);
+  return bFound;
+}
@@ -0,0 +1,223 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_EVENTS (1 << 20) // Per thread; later events are dropped and counted
+#define TRACE_CHUNK 4096       // Events allocated at a time; full chunks are never moved
+
+struct traceEvent_tag
+{
+  const char* pName; // Must be a string literal or otherwise outlive the program
+  uint64_t    iNs;
+  char        phase; // 'B'egin or 'E'nd
+};
+typedef struct traceEvent_tag traceEvent_t;
+
+struct traceChunk_tag
+{
+  traceEvent_t           events[TRACE_CHUNK];
+  struct traceChunk_tag* pNext;
+};
+typedef struct traceChunk_tag traceChunk_t;
+
+/* A buffer belongs to one thread at a time. When its thread exits it is released, and the next new thread
+   takes it over instead of allocating another, so short-lived workers share a timeline row. */
+struct traceBuffer_tag
+{
+  traceChunk_t*           pFirst;
+  traceChunk_t*           pLast;   // Events are added here
+  size_t                  nLast;   // Events in pLast
+  size_t                  nEvents;
+  size_t                  nDropped;
+  unsigned                iTid;
+  const char*             pThreadName;
+  atomic_bool             bFree;   // Set when the owning thread has exited
+  struct traceBuffer_tag* pNext;
+};
+typedef struct traceBuffer_tag traceBuffer_t;
+
+static atomic_bool gEnabled = false;
+static atomic_bool gRegistered = false;
+static const char* gFile = NULL;
+static _Atomic(traceBuffer_t*) gBuffers = NULL; // Lock-free list of every thread's buffer
+static atomic_uint gNextTid = 1;
+static uint64_t gStartNs = 0;
+static pthread_once_t gKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gKey;                      // Releases a thread's buffer when the thread exits
+static _Thread_local traceBuffer_t* tBuffer = NULL;
+
+static uint64_t traceNow();
+static traceBuffer_t* threadBuffer();
+static void traceRecord(const char* pName, char phase);
+static void makeKey();
+static void releaseBuffer(void* pArg);
+static void traceAtExit();
+
+/* Enable tracing. The trace is written to pFile when the program exits; if called again, the last file wins. */
+void traceStart(const char* pFile)
+{
+  gFile = pFile;
+  gStartNs = traceNow();
+  atomic_store(&gEnabled, true);
+  if (!atomic_exchange(&gRegistered, true))
+    atexit(traceAtExit);
+}
+
+/* Name the calling thread in the trace */
+void traceThreadName(const char* pName)
+{
+  if (atomic_load_explicit(&gEnabled, memory_order_relaxed))
+    threadBuffer()->pThreadName = pName;
+}
+
+/* Mark the start of a span on the calling thread */
+void traceBegin(const char* pName)
+{
+  if (atomic_load_explicit(&gEnabled, memory_order_relaxed))
+    traceRecord(pName, 'B');
+}
+
+/* Mark the end of the most recent span pName on the calling thread */
+void traceEnd(const char* pName)
+{
+  if (atomic_load_explicit(&gEnabled, memory_order_relaxed))
+    traceRecord(pName, 'E');
+}
+
+/* Write every thread's events to the trace file. Only call once all traced threads have finished. */
+bool traceWrite()
+{
+  if (!atomic_load(&gEnabled) || gFile == NULL)
+    return true;
+
+  FILE* f = fopen(gFile, "w");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Unable to create trace file '%s': %s\n", gFile, strerror(errno));
+    return false;
+  }
+
+  fputs("{\"traceEvents\":[\n", f);
+  bool bFirst = true;
+  size_t nDropped = 0;
+  for (traceBuffer_t* pBuffer = atomic_load(&gBuffers); pBuffer != NULL; pBuffer = pBuffer->pNext)
+  {
+    if (pBuffer->pThreadName != NULL)
+    {
+      fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+              bFirst ? "" : ",\n", pBuffer->iTid, pBuffer->pThreadName);
+      bFirst = false;
+    }
+    for (traceChunk_t* pChunk = pBuffer->pFirst; pChunk != NULL; pChunk = pChunk->pNext)
+    {
+      size_t nEvents = pChunk == pBuffer->pLast ? pBuffer->nLast : TRACE_CHUNK;
+      for (size_t i = 0; i < nEvents; i++)
+      {
+        traceEvent_t* pEvent = &pChunk->events[i];
+        fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                bFirst ? "" : ",\n", pEvent->pName, pEvent->phase, (double)(pEvent->iNs - gStartNs) / 1000.0, pBuffer->iTid);
+        bFirst = false;
+      }
+    }
+    nDropped += pBuffer->nDropped;
+  }
+  fputs("\n]}\n", f);
+
+  if (nDropped > 0)
+    fprintf(stderr, "Trace buffers were full; %zu events were dropped.\n", nDropped);
+
+  if (fclose(f) != 0)
+  {
+    fprintf(stderr, "Error closing trace file '%s': %s\n", gFile, strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+/* Monotonic time in nanoseconds */
+static uint64_t traceNow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Return the calling thread's buffer. On first use the thread takes over a buffer released by a thread
+   that has exited, or creates one with its first chunk and pushes it onto the global list. */
+static traceBuffer_t* threadBuffer()
+{
+  if (tBuffer == NULL)
+  {
+    pthread_once(&gKeyOnce, makeKey);
+    traceBuffer_t* pBuffer = atomic_load(&gBuffers);
+    for (; pBuffer != NULL; pBuffer = pBuffer->pNext)
+    {
+      bool bFree = true;
+      if (atomic_compare_exchange_strong(&pBuffer->bFree, &bFree, false))
+        break;
+    }
+    if (pBuffer == NULL)
+    {
+      pBuffer = calloc(1, sizeof(traceBuffer_t));
+      pBuffer->pFirst = malloc(sizeof(traceChunk_t));
+      pBuffer->pFirst->pNext = NULL;
+      pBuffer->pLast = pBuffer->pFirst;
+      pBuffer->iTid = atomic_fetch_add(&gNextTid, 1);
+      pBuffer->pNext = atomic_load(&gBuffers);
+      while (!atomic_compare_exchange_weak(&gBuffers, &pBuffer->pNext, pBuffer))
+        ;
+    }
+    pthread_setspecific(gKey, pBuffer);
+    tBuffer = pBuffer;
+  }
+  return tBuffer;
+}
+
+static void traceRecord(const char* pName, char phase)
+{
+  traceBuffer_t* pBuffer = threadBuffer();
+  if (pBuffer->nEvents == TRACE_EVENTS)
+  {
+    pBuffer->nDropped++;
+    return;
+  }
+  if (pBuffer->nLast == TRACE_CHUNK)
+  {
+    if (pBuffer->pLast->pNext == NULL)
+    {
+      pBuffer->pLast->pNext = malloc(sizeof(traceChunk_t));
+      pBuffer->pLast->pNext->pNext = NULL;
+    }
+    pBuffer->pLast = pBuffer->pLast->pNext;
+    pBuffer->nLast = 0;
+  }
+  traceEvent_t* pEvent = &pBuffer->pLast->events[pBuffer->nLast++];
+  pBuffer->nEvents++;
+  pEvent->pName = pName;
+  pEvent->iNs = traceNow();
+  pEvent->phase = phase;
+}
+
+static void makeKey()
+{
+  pthread_key_create(&gKey, releaseBuffer);
+}
+
+/* Thread exit: let the next new thread record into this buffer */
+static void releaseBuffer(void* pArg)
+{
+  traceBuffer_t* pBuffer = pArg;
+  atomic_store(&pBuffer->bFree, true);
+}
+
+static void traceAtExit()
+{
+  traceWrite();
+}
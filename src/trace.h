@@ -0,0 +1,13 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdbool.h>
+
+/* Optional timeline tracer. Each thread records begin/end events into its own buffer without locking;
+   the buffers are written out as Chrome trace-event JSON (viewable in Perfetto) when the program exits.
+   All calls are cheap no-ops until traceStart() is called. */
+void traceStart(const char* pFile);
+void traceThreadName(const char* pName);
+void traceBegin(const char* pName);
+void traceEnd(const char* pName);
+bool traceWrite();
+#endif